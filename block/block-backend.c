@@ -62,6 +62,22 @@ struct BlockBackend {
 
     bool enable_write_cache;
 
+    /*
+     * With request merging enabled, read and write AIO requests submitted
+     * between blk_io_plug() and blk_io_unplug() are held back here and
+     * submitted on unplug, with contiguous requests combined into one.
+     * merge_plugged counts nested plugs whether or not merging is enabled and
+     * is accessed atomically like BlockDriverState.io_plugged;
+     * merge_queue and merge_queue_len are protected by the AioContext lock,
+     * which is held by all callers of blk_io_plug() and blk_aio_*().
+     * The queue is flushed when a drained section begins, because the
+     * requests in it count towards in_flight.
+     */
+    bool request_merging;
+    unsigned int merge_plugged;
+    unsigned int merge_queue_len;
+    QSIMPLEQ_HEAD(, BlkAioEmAIOCB) merge_queue;
+
     /* I/O stats (display with "info blockstats"). */
     BlockAcctStats stats;
 
@@ -369,6 +385,7 @@ BlockBackend *blk_new(AioContext *ctx, uint64_t perm, uint64_t shared_perm)
     block_acct_init(&blk->stats);
 
     qemu_co_queue_init(&blk->queued_requests);
+    QSIMPLEQ_INIT(&blk->merge_queue);
     notifier_list_init(&blk->remove_bs_notifiers);
     notifier_list_init(&blk->insert_bs_notifiers);
     QLIST_INIT(&blk->aio_notifiers);
@@ -1507,6 +1524,8 @@ typedef struct BlkAioEmAIOCB {
     BlkRwCo rwco;
     int64_t bytes;
     bool has_returned;
+    CoroutineEntry *co_entry;
+    QSIMPLEQ_ENTRY(BlkAioEmAIOCB) merge_next;
 } BlkAioEmAIOCB;
 
 static AioContext *blk_aio_em_aiocb_get_aio_context(BlockAIOCB *acb_)
@@ -1537,6 +1556,9 @@ static void blk_aio_complete_bh(void *opaque)
     blk_aio_complete(acb);
 }
 
+static void coroutine_fn blk_aio_read_entry(void *opaque);
+static void coroutine_fn blk_aio_write_entry(void *opaque);
+
 static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset,
                                 int64_t bytes,
                                 void *iobuf, CoroutineEntry co_entry,
@@ -1557,6 +1579,17 @@ static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset,
     };
     acb->bytes = bytes;
     acb->has_returned = false;
+    acb->co_entry = co_entry;
+
+    /* Hold back plain reads and writes until blk_io_unplug() or a drain */
+    if (blk->request_merging && qatomic_read(&blk->merge_plugged) &&
+        !blk->quiesce_counter && iobuf &&
+        (co_entry == blk_aio_read_entry || co_entry == blk_aio_write_entry)) {
+        acb->has_returned = true;
+        QSIMPLEQ_INSERT_TAIL(&blk->merge_queue, acb, merge_next);
+        blk->merge_queue_len++;
+        return &acb->common;
+    }
 
     co = qemu_coroutine_create(co_entry, acb);
     aio_co_enter(blk_get_aio_context(blk), co);
@@ -1594,6 +1627,160 @@ static void coroutine_fn blk_aio_write_entry(void *opaque)
     blk_aio_complete(acb);
 }
 
+typedef struct BlkMergedRequest {
+    BlockBackend *blk;
+    bool is_write;
+    int64_t offset;
+    BdrvRequestFlags flags;
+    QEMUIOVector qiov;
+    BlkAioEmAIOCB **acbs;
+    int nb_acbs;
+} BlkMergedRequest;
+
+static void coroutine_fn blk_aio_merged_entry(void *opaque)
+{
+    BlkMergedRequest *req = opaque;
+    int ret, i;
+
+    if (req->is_write) {
+        ret = blk_co_do_pwritev_part(req->blk, req->offset, req->qiov.size,
+                                     &req->qiov, 0, req->flags);
+    } else {
+        ret = blk_co_do_preadv_part(req->blk, req->offset, req->qiov.size,
+                                    &req->qiov, 0, req->flags);
+    }
+
+    for (i = 0; i < req->nb_acbs; i++) {
+        req->acbs[i]->rwco.ret = ret;
+        blk_aio_complete(req->acbs[i]);
+    }
+
+    qemu_iovec_destroy(&req->qiov);
+    g_free(req->acbs);
+    g_free(req);
+}
+
+/* Starts @nb_acbs contiguous held back requests as a single request */
+static void blk_merge_start(BlockBackend *blk, BlkAioEmAIOCB **acbs,
+                            int nb_acbs, int niov)
+{
+    BlkMergedRequest *req;
+    Coroutine *co;
+    int i;
+
+    for (i = 0; i < nb_acbs; i++) {
+        acbs[i]->has_returned = false;
+    }
+
+    if (nb_acbs == 1) {
+        co = qemu_coroutine_create(acbs[0]->co_entry, acbs[0]);
+    } else {
+        req = g_new(BlkMergedRequest, 1);
+        *req = (BlkMergedRequest) {
+            .blk        = blk,
+            .is_write   = acbs[0]->co_entry == blk_aio_write_entry,
+            .offset     = acbs[0]->rwco.offset,
+            .flags      = acbs[0]->rwco.flags,
+            .acbs       = g_memdup2(acbs, nb_acbs * sizeof(acbs[0])),
+            .nb_acbs    = nb_acbs,
+        };
+        qemu_iovec_init(&req->qiov, niov);
+        for (i = 0; i < nb_acbs; i++) {
+            qemu_iovec_concat(&req->qiov, acbs[i]->rwco.iobuf, 0,
+                              acbs[i]->bytes);
+        }
+
+        block_acct_merge_done(blk_get_stats(blk),
+                              req->is_write ? BLOCK_ACCT_WRITE
+                                            : BLOCK_ACCT_READ,
+                              nb_acbs - 1);
+        co = qemu_coroutine_create(blk_aio_merged_entry, req);
+    }
+
+    aio_co_enter(blk_get_aio_context(blk), co);
+
+    for (i = 0; i < nb_acbs; i++) {
+        acbs[i]->has_returned = true;
+        if (acbs[i]->rwco.ret != NOT_DONE) {
+            replay_bh_schedule_oneshot_event(blk_get_aio_context(blk),
+                                             blk_aio_complete_bh, acbs[i]);
+        }
+    }
+}
+
+static int blk_merge_compare(const void *a, const void *b)
+{
+    const BlkAioEmAIOCB *x = *(BlkAioEmAIOCB * const *)a;
+    const BlkAioEmAIOCB *y = *(BlkAioEmAIOCB * const *)b;
+
+    if (x->co_entry != y->co_entry) {
+        return x->co_entry == blk_aio_write_entry ? 1 : -1;
+    }
+    if (x->rwco.offset != y->rwco.offset) {
+        return x->rwco.offset < y->rwco.offset ? -1 : 1;
+    }
+    return 0;
+}
+
+static bool blk_merge_can_append(BlkAioEmAIOCB *prev, BlkAioEmAIOCB *next)
+{
+    return prev->co_entry == next->co_entry &&
+           prev->rwco.flags == next->rwco.flags &&
+           prev->rwco.offset + prev->bytes == next->rwco.offset;
+}
+
+/* Submits the requests held back while plugged, merging contiguous ones */
+static void blk_merge_submit(BlockBackend *blk)
+{
+    g_autofree BlkAioEmAIOCB **acbs = NULL;
+    BlkAioEmAIOCB *acb;
+    uint64_t max_transfer = blk_get_max_transfer(blk);
+    int max_iov = blk_get_max_iov(blk);
+    int n = blk->merge_queue_len;
+    int i, j;
+
+    if (!n) {
+        return;
+    }
+
+    acbs = g_new(BlkAioEmAIOCB *, n);
+    i = 0;
+    while ((acb = QSIMPLEQ_FIRST(&blk->merge_queue))) {
+        QSIMPLEQ_REMOVE_HEAD(&blk->merge_queue, merge_next);
+        acbs[i++] = acb;
+    }
+    blk->merge_queue_len = 0;
+
+    qsort(acbs, n, sizeof(acbs[0]), blk_merge_compare);
+
+    for (i = 0; i < n; i = j) {
+        QEMUIOVector *qiov = acbs[i]->rwco.iobuf;
+        uint64_t bytes = acbs[i]->bytes;
+        int niov = qiov->niov;
+
+        for (j = i + 1; j < n; j++) {
+            qiov = acbs[j]->rwco.iobuf;
+            if (!blk_merge_can_append(acbs[j - 1], acbs[j]) ||
+                bytes + acbs[j]->bytes > max_transfer ||
+                niov + qiov->niov > max_iov) {
+                break;
+            }
+            bytes += acbs[j]->bytes;
+            niov += qiov->niov;
+        }
+
+        blk_merge_start(blk, &acbs[i], j - i, niov);
+    }
+}
+
+/* Submits the held back requests without ending the plug window */
+static void blk_merge_flush(BlockBackend *blk)
+{
+    if (!QSIMPLEQ_EMPTY(&blk->merge_queue)) {
+        blk_merge_submit(blk);
+    }
+}
+
 BlockAIOCB *blk_aio_pwrite_zeroes(BlockBackend *blk, int64_t offset,
                                   int64_t bytes, BdrvRequestFlags flags,
                                   BlockCompletionFunc *cb, void *opaque)
@@ -1816,6 +2003,9 @@ void blk_drain(BlockBackend *blk)
         bdrv_drained_begin(bs);
     }
 
+    /* Requests held back in a plug window would never complete otherwise */
+    blk_merge_flush(blk);
+
     /* We may have -ENOMEDIUM completions in flight */
     AIO_WAIT_WHILE(blk_get_aio_context(blk),
                    qatomic_mb_read(&blk->in_flight) > 0);
@@ -1839,6 +2029,8 @@ void blk_drain_all(void)
 
         aio_context_acquire(ctx);
 
+        blk_merge_flush(blk);
+
         /* We may have -ENOMEDIUM completions in flight */
         AIO_WAIT_WHILE(ctx, qatomic_mb_read(&blk->in_flight) > 0);
 
@@ -1981,6 +2173,12 @@ void blk_set_enable_write_cache(BlockBackend *blk, bool wce)
     blk->enable_write_cache = wce;
 }
 
+void blk_set_request_merging(BlockBackend *blk, bool enable)
+{
+    GLOBAL_STATE_CODE();
+    blk->request_merging = enable;
+}
+
 void blk_activate(BlockBackend *blk, Error **errp)
 {
     BlockDriverState *bs = blk_bs(blk);
@@ -2338,6 +2536,8 @@ void coroutine_fn blk_co_io_plug(BlockBackend *blk)
     if (bs) {
         bdrv_co_io_plug(bs);
     }
+
+    qatomic_inc(&blk->merge_plugged);
 }
 
 void coroutine_fn blk_co_io_unplug(BlockBackend *blk)
@@ -2346,6 +2546,11 @@ void coroutine_fn blk_co_io_unplug(BlockBackend *blk)
     IO_CODE();
     GRAPH_RDLOCK_GUARD();
 
+    assert(blk->merge_plugged);
+    if (qatomic_fetch_dec(&blk->merge_plugged) == 1) {
+        blk_merge_submit(blk);
+    }
+
     if (bs) {
         bdrv_co_io_unplug(bs);
     }
@@ -2568,6 +2773,9 @@ static void blk_root_drained_begin(BdrvChild *child)
     BlockBackend *blk = child->opaque;
     ThrottleGroupMember *tgm = &blk->public.throttle_group_member;
 
+    /* Held back requests count towards in_flight, so submit them now */
+    blk_merge_flush(blk);
+
     if (++blk->quiesce_counter == 1) {
         if (blk->dev_ops && blk->dev_ops->drained_begin) {
             blk->dev_ops->drained_begin(blk->dev_opaque);
@@ -157,6 +157,9 @@ typedef struct BDRVRawState {
     bool has_write_zeroes:1;
     bool use_linux_aio:1;
     bool use_linux_io_uring:1;
+    bool use_io_uring_iopoll:1;
+    /* s->fd may be in the fixed file table of the current io_uring */
+    bool luring_fd_registered:1;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
     bool needs_alignment;
@@ -190,6 +193,7 @@ static int fd_open(BlockDriverState *bs)
 }
 
 static int64_t coroutine_fn raw_co_getlength(BlockDriverState *bs);
+static void raw_close_fd(BlockDriverState *bs, int fd);
 
 typedef struct RawPosixAIOData {
     BlockDriverState *bs;
@@ -572,6 +576,14 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "check that page cache was dropped on live migration (default: off)"
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "x-io-uring-iopoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "poll for io_uring completions, requires aio=io_uring "
+                    "and cache.direct=on (default: off)",
+        },
+#endif
         { /* end of list */ }
     },
 };
@@ -627,6 +639,8 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->use_io_uring_iopoll = qemu_opt_get_bool(opts, "x-io-uring-iopoll",
+                                               false);
 #endif
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
@@ -724,7 +738,21 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 #endif /* !defined(CONFIG_LINUX_AIO) */
 
 #ifdef CONFIG_LINUX_IO_URING
-    if (s->use_linux_io_uring) {
+    if (s->use_io_uring_iopoll) {
+        /* Polled completions are only available for O_DIRECT reads/writes */
+        if (!s->use_linux_io_uring || !(s->open_flags & O_DIRECT)) {
+            error_setg(errp, "x-io-uring-iopoll requires aio=io_uring and "
+                             "cache.direct=on");
+            ret = -EINVAL;
+            goto fail;
+        }
+        if (!aio_setup_linux_io_uring_iopoll(bdrv_get_aio_context(bs),
+                                             errp)) {
+            error_prepend(errp, "Unable to use io_uring with polled "
+                                "completions: ");
+            goto fail;
+        }
+    } else if (s->use_linux_io_uring) {
         if (!aio_setup_linux_io_uring(bdrv_get_aio_context(bs), errp)) {
             error_prepend(errp, "Unable to use io_uring: ");
             goto fail;
@@ -799,7 +827,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
-        qemu_close(s->fd);
+        raw_close_fd(bs, s->fd);
     }
     if (filename && (bdrv_flags & BDRV_O_TEMPORARY)) {
         unlink(filename);
@@ -1127,6 +1155,12 @@ static int raw_reopen_prepare(BDRVReopenState *state,
     rs->check_cache_dropped =
         qemu_opt_get_bool_del(opts, "x-check-cache-dropped", false);
 
+    if (s->use_io_uring_iopoll && !(state->flags & BDRV_O_NOCACHE)) {
+        error_setg(errp, "x-io-uring-iopoll requires cache.direct=on");
+        ret = -EINVAL;
+        goto out;
+    }
+
     /* This driver's reopen function doesn't currently allow changing
      * other options, so let's put them back in the original QDict and
      * bdrv_reopen_prepare() will detect changes and complain. */
@@ -2070,6 +2104,20 @@ static bool bdrv_qiov_is_aligned(BlockDriverState *bs, QEMUIOVector *qiov)
     return true;
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/* Returns the io_uring that serves read and write requests on @bs */
+static LuringState *raw_get_luring(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+    AioContext *ctx = bdrv_get_aio_context(bs);
+
+    if (s->use_io_uring_iopoll) {
+        return aio_get_linux_io_uring_iopoll(ctx);
+    }
+    return aio_get_linux_io_uring(ctx);
+}
+#endif
+
 static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
                                    uint64_t bytes, QEMUIOVector *qiov, int type)
 {
@@ -2089,8 +2137,9 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
         type |= QEMU_AIO_MISALIGNED;
 #ifdef CONFIG_LINUX_IO_URING
     } else if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        LuringState *aio = raw_get_luring(bs);
         assert(qiov->size == bytes);
+        s->luring_fd_registered = true;
         return luring_co_submit(bs, aio, s->fd, offset, qiov, type);
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2143,7 +2192,7 @@ static void coroutine_fn raw_co_io_plug(BlockDriverState *bs)
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        LuringState *aio = raw_get_luring(bs);
         luring_io_plug(bs, aio);
     }
 #endif
@@ -2160,7 +2209,7 @@ static void coroutine_fn raw_co_io_unplug(BlockDriverState *bs)
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        LuringState *aio = raw_get_luring(bs);
         luring_io_unplug(bs, aio);
     }
 #endif
@@ -2184,14 +2233,54 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
     };
 
 #ifdef CONFIG_LINUX_IO_URING
-    if (s->use_linux_io_uring) {
+    /* IOPOLL rings cannot fsync, use the thread pool instead */
+    if (s->use_linux_io_uring && !s->use_io_uring_iopoll) {
         LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        s->luring_fd_registered = true;
         return luring_co_submit(bs, aio, s->fd, 0, NULL, QEMU_AIO_FLUSH);
     }
 #endif
     return raw_thread_pool_submit(bs, handle_aiocb_flush, &acb);
 }
 
+/*
+ * Drops @fd, which is s->fd, from the fixed file table of the io_uring used
+ * by @bs, so that the ring no longer holds a reference to the file.  Only
+ * descriptors that went through the ring are in its table, which also
+ * means that the ring exists: an open that fails before the ring is set
+ * up must not look for it.
+ */
+static void raw_aio_unregister_fd(BlockDriverState *bs, int fd)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+
+    if (s->luring_fd_registered && fd >= 0) {
+        luring_unregister_fd(raw_get_luring(bs), fd);
+        s->luring_fd_registered = false;
+    }
+#endif
+}
+
+/*
+ * Closes @fd, which is or was s->fd.  Every close of an image descriptor
+ * must go through here: the io_uring fixed file table is looked up by
+ * descriptor number, so a stale slot would send the I/O of a file that
+ * later gets the same number to the old file.
+ */
+static void raw_close_fd(BlockDriverState *bs, int fd)
+{
+    raw_aio_unregister_fd(bs, fd);
+    qemu_close(fd);
+}
+
+static void raw_aio_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+    raw_aio_unregister_fd(bs, s->fd);
+}
+
 static void raw_aio_attach_aio_context(BlockDriverState *bs,
                                        AioContext *new_context)
 {
@@ -2209,7 +2298,14 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
         Error *local_err = NULL;
-        if (!aio_setup_linux_io_uring(new_context, &local_err)) {
+        LuringState *aio;
+
+        if (s->use_io_uring_iopoll) {
+            aio = aio_setup_linux_io_uring_iopoll(new_context, &local_err);
+        } else {
+            aio = aio_setup_linux_io_uring(new_context, &local_err);
+        }
+        if (!aio) {
             error_reportf_err(local_err, "Unable to use linux io_uring, "
                                          "falling back to thread pool: ");
             s->use_linux_io_uring = false;
@@ -2223,7 +2319,7 @@ static void raw_close(BlockDriverState *bs)
     BDRVRawState *s = bs->opaque;
 
     if (s->fd >= 0) {
-        qemu_close(s->fd);
+        raw_close_fd(bs, s->fd);
         s->fd = -1;
     }
 }
@@ -3246,7 +3342,7 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
-        qemu_close(s->fd);
+        raw_close_fd(bs, s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
     }
@@ -3345,6 +3441,7 @@ BlockDriver bdrv_file = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_co_io_plug        = raw_co_io_plug,
     .bdrv_co_io_unplug      = raw_co_io_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate                   = raw_co_truncate,
@@ -3717,6 +3814,7 @@ static BlockDriver bdrv_host_device = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_co_io_plug        = raw_co_io_plug,
     .bdrv_co_io_unplug      = raw_co_io_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate                   = raw_co_truncate,
@@ -3841,6 +3939,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_co_io_plug        = raw_co_io_plug,
     .bdrv_co_io_unplug      = raw_co_io_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate                   = raw_co_truncate,
@@ -3895,7 +3994,7 @@ static int cdrom_reopen(BlockDriverState *bs)
      * FreeBSD seems to not notice sometimes...
      */
     if (s->fd >= 0)
-        qemu_close(s->fd);
+        raw_close_fd(bs, s->fd);
     fd = qemu_open(bs->filename, s->open_flags, NULL);
     if (fd < 0) {
         s->fd = -1;
@@ -3970,6 +4069,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_co_io_plug        = raw_co_io_plug,
     .bdrv_co_io_unplug      = raw_co_io_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate                   = raw_co_truncate,
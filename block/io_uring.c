@@ -21,6 +21,9 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Size of the ring's table of registered files */
+#define MAX_FIXED_FILES 64
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -55,6 +58,22 @@ typedef struct LuringState {
 
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+    /*
+     * File descriptors registered with the ring, indexed by their slot in
+     * the ring's file table, -1 for unused slots.  Requests on registered
+     * files skip the per-request file lookup in the kernel.
+     */
+    bool has_fixed_files;
+    int fixed_fds[MAX_FIXED_FILES];
+
+    /*
+     * The ring was created with IORING_SETUP_IOPOLL.  Completions of polled
+     * requests are not signalled on the ring fd, they only appear in the
+     * completion queue when reaped with io_uring_enter(IORING_ENTER_GETEVENTS),
+     * which io_uring_peek_cqe() does for such rings.
+     */
+    bool iopoll;
 } LuringState;
 
 /**
@@ -213,6 +232,15 @@ end:
             aio_co_wake(luringcb->co);
         }
     }
+
+    if (s->iopoll && s->io_q.in_flight) {
+        /*
+         * Nothing will ever make the ring fd readable for the remaining
+         * requests.  Keep the BH scheduled so that the event loop does not
+         * block and keeps reaping until they have all completed.
+         */
+        return;
+    }
     qemu_bh_cancel(s->completion_bh);
 }
 
@@ -286,6 +314,12 @@ static void qemu_luring_completion_cb(void *opaque)
 static bool qemu_luring_poll_cb(void *opaque)
 {
     LuringState *s = opaque;
+    struct io_uring_cqe *cqe;
+
+    if (s->iopoll) {
+        /* Polls the device for completions, without consuming them */
+        return s->io_q.in_flight && io_uring_peek_cqe(&s->ring, &cqe) == 0;
+    }
 
     return io_uring_cq_ready(&s->ring);
 }
@@ -323,6 +357,65 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
     }
 }
 
+/**
+ * luring_fixed_file:
+ * @s: AIO state
+ * @fd: file descriptor for I/O
+ *
+ * Returns the slot of @fd in the ring's file table, registering it in a free
+ * slot if needed, or -1 if @fd must be used as a plain file descriptor.
+ */
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    int i, slot = -1;
+
+    if (!s->has_fixed_files) {
+        return -1;
+    }
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_fds[i] == fd) {
+            return i;
+        }
+        if (s->fixed_fds[i] == -1 && slot == -1) {
+            slot = i;
+        }
+    }
+
+    if (slot == -1 || io_uring_register_files_update(&s->ring, slot,
+                                                     &fd, 1) != 1) {
+        return -1;
+    }
+
+    trace_luring_register_file(s, fd, slot);
+    s->fixed_fds[slot] = fd;
+    return slot;
+}
+
+/**
+ * luring_unregister_fd:
+ * @s: AIO state
+ * @fd: file descriptor
+ *
+ * Removes @fd from the ring's file table.  Must be called with no requests
+ * in flight on @fd before it is closed, or when the file stops using this
+ * ring, because the table keeps a reference to the file.
+ */
+void luring_unregister_fd(LuringState *s, int fd)
+{
+    int none = -1;
+    int i;
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_fds[i] == fd) {
+            trace_luring_unregister_file(s, fd, i);
+            io_uring_register_files_update(&s->ring, i, &none, 1);
+            s->fixed_fds[i] = -1;
+            return;
+        }
+    }
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -337,7 +430,7 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
 static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                             uint64_t offset, int type)
 {
-    int ret;
+    int ret, slot;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
 
     switch (type) {
@@ -350,6 +443,8 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                             luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_FLUSH:
+        /* IORING_OP_FSYNC is not supported on IOPOLL rings */
+        assert(!s->iopoll);
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
         break;
     default:
@@ -357,6 +452,12 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+
+    slot = luring_fixed_file(s, fd);
+    if (slot >= 0) {
+        sqes->fd = slot;
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -414,22 +515,32 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(bool iopoll, Error **errp)
 {
-    int rc;
+    int rc, i;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
 
-    trace_luring_init_state(s, sizeof(*s));
+    trace_luring_init_state(s, sizeof(*s), iopoll);
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    rc = io_uring_queue_init(MAX_ENTRIES, ring,
+                             iopoll ? IORING_SETUP_IOPOLL : 0);
     if (rc < 0) {
         error_setg_errno(errp, errno, "failed to init linux io_uring ring");
         g_free(s);
         return NULL;
     }
+    s->iopoll = iopoll;
 
     ioq_init(&s->io_q);
+
+    /* Start with an empty table, files are registered on first use */
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        s->fixed_fds[i] = -1;
+    }
+    s->has_fixed_files =
+        io_uring_register_files(ring, s->fixed_fds, MAX_FIXED_FILES) == 0;
+
     return s;
 
 }
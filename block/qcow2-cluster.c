@@ -562,6 +562,97 @@ do_perform_cow_write(BlockDriverState *bs, uint64_t cluster_offset,
 }
 
 
+typedef struct Qcow2L2Prefetch {
+    BlockDriverState *bs;
+    uint64_t offset;
+} Qcow2L2Prefetch;
+
+/* Loads the L2 slice mapping guest offset @p->offset into the L2 cache */
+static void coroutine_fn l2_prefetch_entry(void *opaque)
+{
+    Qcow2L2Prefetch *p = opaque;
+    BlockDriverState *bs = p->bs;
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t l1_index, l2_offset, *l2_slice;
+
+    bdrv_graph_co_rdlock();
+    qemu_co_mutex_lock(&s->lock);
+
+    /* The L1 table may have changed since the prefetch was scheduled */
+    l1_index = offset_to_l1_index(s, p->offset);
+    l2_offset = l1_index < s->l1_size ?
+                s->l1_table[l1_index] & L1E_OFFSET_MASK : 0;
+
+    if (l2_offset && !offset_into_cluster(s, l2_offset)) {
+        trace_qcow2_l2_prefetch(bs, p->offset, l2_offset);
+        if (l2_load(bs, p->offset, l2_offset, &l2_slice) == 0) {
+            qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+            s->l2_prefetches++;
+        }
+    }
+
+    s->l2_prefetch_in_flight = false;
+    qemu_co_mutex_unlock(&s->lock);
+    bdrv_graph_co_rdunlock();
+
+    bdrv_dec_in_flight(bs);
+    g_free(p);
+}
+
+/*
+ * Called with s->lock held for every mapping lookup of @offset. When the
+ * lookups move on to the L2 slice following the previous one, start loading
+ * the slice after that in the background, so that sequential reads of cold
+ * images find it in the cache instead of waiting for it.
+ */
+static void l2_readahead(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t slice_bytes = (uint64_t)s->l2_slice_size << s->cluster_bits;
+    uint64_t slice = offset / slice_bytes;
+    uint64_t next_offset = (slice + 1) * slice_bytes;
+    bool sequential = slice == s->l2_readahead_slice + 1;
+    uint64_t l1_index, l2_offset, start_of_slice;
+    Qcow2L2Prefetch *p;
+    Coroutine *co;
+
+    s->l2_readahead_slice = slice;
+
+    if (!sequential || s->l2_prefetch_in_flight || !qemu_in_coroutine() ||
+        next_offset >= bs->total_sectors * BDRV_SECTOR_SIZE) {
+        return;
+    }
+
+    /* Nothing to do if the next slice is unallocated or already cached */
+    l1_index = offset_to_l1_index(s, next_offset);
+    if (l1_index >= s->l1_size) {
+        return;
+    }
+    l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+    if (!l2_offset || offset_into_cluster(s, l2_offset)) {
+        return;
+    }
+    start_of_slice = l2_entry_size(s) *
+        (offset_to_l2_index(s, next_offset) -
+         offset_to_l2_slice_index(s, next_offset));
+    if (qcow2_cache_is_table_offset(s->l2_table_cache,
+                                    l2_offset + start_of_slice)) {
+        return;
+    }
+
+    p = g_new(Qcow2L2Prefetch, 1);
+    *p = (Qcow2L2Prefetch) {
+        .bs     = bs,
+        .offset = next_offset,
+    };
+
+    s->l2_prefetch_in_flight = true;
+    bdrv_inc_in_flight(bs);
+    co = qemu_coroutine_create(l2_prefetch_entry, p);
+    aio_co_enter(bdrv_get_aio_context(bs), co);
+}
+
+
 /*
  * get_host_offset
  *
@@ -639,6 +730,8 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
         return ret;
     }
 
+    l2_readahead(bs, offset);
+
     /* find the cluster offset for the given disk offset */
 
     l2_index = offset_to_l2_slice_index(s, offset);
@@ -1136,6 +1229,17 @@ void qcow2_alloc_cluster_abort(BlockDriverState *bs, QCowL2Meta *m)
     }
 }
 
+/*
+ * Returns the BDRVQcow2State.cluster_allocs list that tracks in-flight
+ * allocations in the L2 slice containing @guest_offset.
+ */
+static unsigned cluster_allocs_bucket(BDRVQcow2State *s, uint64_t guest_offset)
+{
+    uint64_t slice = (guest_offset >> s->cluster_bits) / s->l2_slice_size;
+
+    return slice % QCOW2_CLUSTER_ALLOCS_BUCKETS;
+}
+
 /*
  * For a given write request, create a new QCowL2Meta structure, add
  * it to @m and the BDRVQcow2State.cluster_allocs list. If the write
@@ -1169,6 +1273,7 @@ static int calculate_l2_meta(BlockDriverState *bs, uint64_t host_cluster_offset,
     unsigned nb_clusters = size_to_clusters(s, cow_end_from);
     QCowL2Meta *old_m = *m;
     QCow2SubclusterType type;
+    unsigned bucket;
     int i;
     bool skip_cow = keep_old;
 
@@ -1318,7 +1423,8 @@ static int calculate_l2_meta(BlockDriverState *bs, uint64_t host_cluster_offset,
     };
 
     qemu_co_queue_init(&(*m)->dependent_requests);
-    QLIST_INSERT_HEAD(&s->cluster_allocs, *m, next_in_flight);
+    bucket = cluster_allocs_bucket(s, guest_offset);
+    QLIST_INSERT_HEAD(&s->cluster_allocs[bucket], *m, next_in_flight);
 
     return 0;
 }
@@ -1406,57 +1512,72 @@ static int coroutine_fn handle_dependencies(BlockDriverState *bs,
     BDRVQcow2State *s = bs->opaque;
     QCowL2Meta *old_alloc;
     uint64_t bytes = *cur_bytes;
+    uint64_t slice_bytes = (uint64_t)s->l2_slice_size << s->cluster_bits;
+    uint64_t first_slice = guest_offset / slice_bytes;
+    uint64_t nb_slices = (guest_offset + bytes - 1) / slice_bytes
+                         - first_slice + 1;
+    uint64_t i;
 
-    QLIST_FOREACH(old_alloc, &s->cluster_allocs, next_in_flight) {
+    /*
+     * An allocation never spans more than one L2 slice, so only the lists
+     * of the slices touched by this request can contain conflicts.
+     */
+    for (i = 0; i < MIN(nb_slices, QCOW2_CLUSTER_ALLOCS_BUCKETS); i++) {
+        unsigned bucket = (first_slice + i) % QCOW2_CLUSTER_ALLOCS_BUCKETS;
 
-        uint64_t start = guest_offset;
-        uint64_t end = start + bytes;
-        uint64_t old_start = start_of_cluster(s, l2meta_cow_start(old_alloc));
-        uint64_t old_end = ROUND_UP(l2meta_cow_end(old_alloc), s->cluster_size);
+        QLIST_FOREACH(old_alloc, &s->cluster_allocs[bucket], next_in_flight) {
 
-        if (end <= old_start || start >= old_end) {
-            /* No intersection */
-            continue;
-        }
+            uint64_t start = guest_offset;
+            uint64_t end = start + bytes;
+            uint64_t old_start =
+                start_of_cluster(s, l2meta_cow_start(old_alloc));
+            uint64_t old_end =
+                ROUND_UP(l2meta_cow_end(old_alloc), s->cluster_size);
 
-        if (old_alloc->keep_old_clusters &&
-            (end <= l2meta_cow_start(old_alloc) ||
-             start >= l2meta_cow_end(old_alloc)))
-        {
-            /*
-             * Clusters intersect but COW areas don't. And cluster itself is
-             * already allocated. So, there is no actual conflict.
-             */
-            continue;
-        }
+            if (end <= old_start || start >= old_end) {
+                /* No intersection */
+                continue;
+            }
 
-        /* Conflict */
+            if (old_alloc->keep_old_clusters &&
+                (end <= l2meta_cow_start(old_alloc) ||
+                 start >= l2meta_cow_end(old_alloc)))
+            {
+                /*
+                 * Clusters intersect but COW areas don't. And cluster itself is
+                 * already allocated. So, there is no actual conflict.
+                 */
+                continue;
+            }
 
-        if (start < old_start) {
-            /* Stop at the start of a running allocation */
-            bytes = old_start - start;
-        } else {
-            bytes = 0;
-        }
+            /* Conflict */
 
-        /*
-         * Stop if an l2meta already exists. After yielding, it wouldn't
-         * be valid any more, so we'd have to clean up the old L2Metas
-         * and deal with requests depending on them before starting to
-         * gather new ones. Not worth the trouble.
-         */
-        if (bytes == 0 && *m) {
-            *cur_bytes = 0;
-            return 0;
-        }
+            if (start < old_start) {
+                /* Stop at the start of a running allocation */
+                bytes = old_start - start;
+            } else {
+                bytes = 0;
+            }
 
-        if (bytes == 0) {
             /*
-             * Wait for the dependency to complete. We need to recheck
-             * the free/allocated clusters when we continue.
+             * Stop if an l2meta already exists. After yielding, it wouldn't
+             * be valid any more, so we'd have to clean up the old L2Metas
+             * and deal with requests depending on them before starting to
+             * gather new ones. Not worth the trouble.
              */
-            qemu_co_queue_wait(&old_alloc->dependent_requests, &s->lock);
-            return -EAGAIN;
+            if (bytes == 0 && *m) {
+                *cur_bytes = 0;
+                return 0;
+            }
+
+            if (bytes == 0) {
+                /*
+                 * Wait for the dependency to complete. We need to recheck
+                 * the free/allocated clusters when we continue.
+                 */
+                qemu_co_queue_wait(&old_alloc->dependent_requests, &s->lock);
+                return -EAGAIN;
+            }
         }
     }
 
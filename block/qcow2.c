@@ -1605,7 +1605,9 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
-    QLIST_INIT(&s->cluster_allocs);
+    for (i = 0; i < QCOW2_CLUSTER_ALLOCS_BUCKETS; i++) {
+        QLIST_INIT(&s->cluster_allocs[i]);
+    }
     QTAILQ_INIT(&s->discards);
 
     /* read qcow2 extensions */
@@ -5246,6 +5248,22 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs,
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BlockStatsSpecificQcow2 *q = &stats->u.qcow2;
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    qcow2_cache_get_stats(s->l2_table_cache, &q->l2_cache_hits,
+                          &q->l2_cache_misses);
+    qcow2_cache_get_stats(s->refcount_block_cache, &q->refcount_cache_hits,
+                          &q->refcount_cache_misses);
+    q->l2_prefetches = s->l2_prefetches;
+
+    return stats;
+}
+
 static int qcow2_has_zero_init(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -6093,6 +6111,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure           = qcow2_measure,
     .bdrv_co_get_info       = qcow2_co_get_info,
     .bdrv_get_specific_info = qcow2_get_specific_info,
+    .bdrv_get_specific_stats = qcow2_get_specific_stats,
 
     .bdrv_co_save_vmstate   = qcow2_co_save_vmstate,
     .bdrv_co_load_vmstate   = qcow2_co_load_vmstate,
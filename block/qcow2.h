@@ -71,6 +71,9 @@
 /* Maximum of parallel sub-request per guest request */
 #define QCOW2_MAX_WORKERS 8
 
+/* Number of lists that in-flight cluster allocations are hashed into */
+#define QCOW2_CLUSTER_ALLOCS_BUCKETS 64
+
 /* indicate that the refcount of the referenced cluster is exactly one. */
 #define QCOW_OFLAG_COPIED     (1ULL << 63)
 /* indicate that the cluster is compressed (they never have the copied flag) */
@@ -347,7 +350,13 @@ typedef struct BDRVQcow2State {
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
 
-    QLIST_HEAD(, QCowL2Meta) cluster_allocs;
+    /* L2 slice (in guest address space) of the last mapping lookup */
+    uint64_t l2_readahead_slice;
+    bool l2_prefetch_in_flight;
+    uint64_t l2_prefetches;
+
+    /* In-flight allocations, hashed by the L2 slice that they update */
+    QLIST_HEAD(, QCowL2Meta) cluster_allocs[QCOW2_CLUSTER_ALLOCS_BUCKETS];
 
     uint64_t *refcount_table;
     uint64_t refcount_table_offset;
@@ -977,6 +986,7 @@ void qcow2_cache_depends_on_flush(Qcow2Cache *c);
 void qcow2_cache_clean_unused(Qcow2Cache *c);
 int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c);
 
+void qcow2_cache_get_stats(Qcow2Cache *c, uint64_t *hits, uint64_t *misses);
 int qcow2_cache_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     void **table);
 int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
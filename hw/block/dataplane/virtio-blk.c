@@ -43,13 +43,22 @@ struct VirtIOBlockDataPlane {
      */
     IOThread *iothread;
     AioContext *ctx;
+
+    /*
+     * IOThreads from iothread-vq-mapping and the AioContext that services
+     * each virtqueue.  Block I/O always runs in ctx.
+     */
+    IOThread **vq_iothreads;
+    unsigned num_vq_iothreads;
+    AioContext **vq_aio_context;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
 void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
 {
     if (s->batch_notifications) {
-        set_bit(virtio_get_queue_index(vq), s->batch_notify_vqs);
+        /* May run in a virtqueue IOThread, see iothread-vq-mapping */
+        set_bit_atomic(virtio_get_queue_index(vq), s->batch_notify_vqs);
         qemu_bh_schedule(s->bh);
     } else {
         virtio_notify_irqfd(s->vdev, vq);
@@ -60,14 +69,11 @@ static void notify_guest_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
     unsigned nvqs = s->conf->num_queues;
-    unsigned long bitmap[BITS_TO_LONGS(nvqs)];
     unsigned j;
 
-    memcpy(bitmap, s->batch_notify_vqs, sizeof(bitmap));
-    memset(s->batch_notify_vqs, 0, sizeof(bitmap));
-
     for (j = 0; j < nvqs; j += BITS_PER_LONG) {
-        unsigned long bits = bitmap[j / BITS_PER_LONG];
+        unsigned long *p = &s->batch_notify_vqs[j / BITS_PER_LONG];
+        unsigned long bits = qatomic_xchg(p, 0);
 
         while (bits != 0) {
             unsigned i = j + ctzl(bits);
@@ -80,6 +86,55 @@ static void notify_guest_bh(void *opaque)
     }
 }
 
+static void virtio_blk_release_vq_iothreads(VirtIOBlockDataPlane *s)
+{
+    unsigned i;
+
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        object_unref(OBJECT(s->vq_iothreads[i]));
+    }
+    g_free(s->vq_iothreads);
+    g_free(s->vq_aio_context);
+}
+
+/* Context: QEMU global mutex held */
+static bool virtio_blk_setup_vq_iothreads(VirtIOBlockDataPlane *s,
+                                          Error **errp)
+{
+    strList *node;
+    unsigned i;
+
+    for (node = s->conf->iothread_vq_mapping; node; node = node->next) {
+        s->num_vq_iothreads++;
+    }
+    s->vq_iothreads = g_new0(IOThread *, s->num_vq_iothreads);
+    s->vq_aio_context = g_new(AioContext *, s->conf->num_queues);
+
+    for (node = s->conf->iothread_vq_mapping, i = 0; node;
+         node = node->next, i++) {
+        IOThread *iothread = iothread_by_id(node->value);
+
+        if (!iothread) {
+            error_setg(errp, "IOThread \"%s\" object not found", node->value);
+            s->num_vq_iothreads = i;
+            return false;
+        }
+        object_ref(OBJECT(iothread));
+        s->vq_iothreads[i] = iothread;
+    }
+
+    for (i = 0; i < s->conf->num_queues; i++) {
+        if (s->num_vq_iothreads) {
+            IOThread *iothread = s->vq_iothreads[i % s->num_vq_iothreads];
+
+            s->vq_aio_context[i] = iothread_get_aio_context(iothread);
+        } else {
+            s->vq_aio_context[i] = s->ctx;
+        }
+    }
+    return true;
+}
+
 /* Context: QEMU global mutex held */
 bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
                                   VirtIOBlockDataPlane **dataplane,
@@ -91,7 +146,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->iothread || conf->iothread_vq_mapping) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -120,13 +175,34 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s->vdev = vdev;
     s->conf = conf;
 
-    if (conf->iothread) {
-        s->iothread = conf->iothread;
+    /*
+     * Without an explicit iothread, the BlockBackend goes to the first
+     * IOThread of iothread-vq-mapping.
+     */
+    if (conf->iothread || conf->iothread_vq_mapping) {
+        s->iothread = conf->iothread ?:
+                      iothread_by_id(conf->iothread_vq_mapping->value);
+        if (!s->iothread) {
+            error_setg(errp, "IOThread \"%s\" object not found",
+                       conf->iothread_vq_mapping->value);
+            g_free(s);
+            return false;
+        }
         object_ref(OBJECT(s->iothread));
         s->ctx = iothread_get_aio_context(s->iothread);
     } else {
         s->ctx = qemu_get_aio_context();
     }
+
+    if (!virtio_blk_setup_vq_iothreads(s, errp)) {
+        virtio_blk_release_vq_iothreads(s);
+        if (s->iothread) {
+            object_unref(OBJECT(s->iothread));
+        }
+        g_free(s);
+        return false;
+    }
+
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
@@ -148,6 +224,7 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
     assert(!vblk->dataplane_started);
     g_free(s->batch_notify_vqs);
     qemu_bh_delete(s->bh);
+    virtio_blk_release_vq_iothreads(s);
     if (s->iothread) {
         object_unref(OBJECT(s->iothread));
     }
@@ -245,13 +322,23 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
 
-        virtio_queue_aio_attach_host_notifier(vq, s->ctx);
+        aio_context_acquire(ctx);
+        if (ctx == s->ctx) {
+            virtio_queue_aio_attach_host_notifier(vq, ctx);
+        } else {
+            /*
+             * The polling callbacks touch the virtqueue without taking the
+             * AioContext lock of the BlockBackend, which serializes this
+             * virtqueue with request completion in s->ctx.
+             */
+            virtio_queue_aio_attach_host_notifier_no_poll(vq, ctx);
+        }
+        aio_context_release(ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_aio_context:
@@ -277,17 +364,20 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
 
 /* Stop notifications for new requests from guest.
  *
- * Context: BH in IOThread
+ * Context: BH in IOThread, for each AioContext that services virtqueues
  */
 static void virtio_blk_data_plane_stop_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
     unsigned i;
 
     for (i = 0; i < s->conf->num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_detach_host_notifier(vq, s->ctx);
+        if (s->vq_aio_context[i] == ctx) {
+            virtio_queue_aio_detach_host_notifier(vq, ctx);
+        }
     }
 }
 
@@ -314,6 +404,20 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    /*
+     * Virtqueue IOThreads take the AioContext lock of s->ctx to submit
+     * requests, so stop them before taking that lock here.
+     */
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        AioContext *ctx = iothread_get_aio_context(s->vq_iothreads[i]);
+
+        if (ctx != s->ctx) {
+            aio_context_acquire(ctx);
+            aio_wait_bh_oneshot(ctx, virtio_blk_data_plane_stop_bh, s);
+            aio_context_release(ctx);
+        }
+    }
+
     aio_context_acquire(s->ctx);
     aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
@@ -20,6 +20,7 @@
 #include "trace.h"
 #include "hw/block/block.h"
 #include "hw/qdev-properties.h"
+#include "hw/qdev-properties-system.h"
 #include "sysemu/blockdev.h"
 #include "sysemu/block-ram-registrar.h"
 #include "sysemu/sysemu.h"
@@ -501,6 +502,23 @@ static void virtio_blk_handle_flush(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     blk_aio_flush(s->blk, virtio_blk_flush_complete, req);
 }
 
+/*
+ * Cache the size of the disk for virtqueues that are serviced outside the
+ * BlockBackend's AioContext, where blk_get_geometry() must not be called.
+ *
+ * Context: QEMU global mutex held
+ */
+static void virtio_blk_update_nb_sectors(VirtIOBlock *s)
+{
+    AioContext *ctx = blk_get_aio_context(s->blk);
+    uint64_t nb_sectors;
+
+    aio_context_acquire(ctx);
+    blk_get_geometry(s->blk, &nb_sectors);
+    aio_context_release(ctx);
+    qatomic_set(&s->nb_sectors, nb_sectors);
+}
+
 static bool virtio_blk_sect_range_ok(VirtIOBlock *dev,
                                      uint64_t sector, size_t size)
 {
@@ -516,7 +534,11 @@ static bool virtio_blk_sect_range_ok(VirtIOBlock *dev,
     if (size % dev->conf.conf.logical_block_size) {
         return false;
     }
-    blk_get_geometry(dev->blk, &total_sectors);
+    if (in_aio_context_home_thread(blk_get_aio_context(dev->blk))) {
+        blk_get_geometry(dev->blk, &total_sectors);
+    } else {
+        total_sectors = qatomic_read(&dev->nb_sectors);
+    }
     if (sector > total_sectors || nb_sectors > total_sectors - sector) {
         return false;
     }
@@ -760,9 +782,23 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
     VirtIOBlockReq *req;
     MultiReqBuffer mrb = {};
     bool suppress_notifications = virtio_queue_get_notification(vq);
+    AioContext *ctx = blk_get_aio_context(s->blk);
+    /*
+     * A virtqueue may be serviced by an IOThread other than the one that
+     * runs the BlockBackend (iothread-vq-mapping).  Its requests are handed
+     * over to the BlockBackend's AioContext by aio_co_enter(), so there is
+     * nothing to plug in this thread.
+     */
+    bool plug = in_aio_context_home_thread(ctx);
 
-    aio_context_acquire(blk_get_aio_context(s->blk));
-    blk_io_plug(s->blk);
+    /*
+     * This lock is shared by all virtqueues, so virtqueues mapped to
+     * different IOThreads are still processed one at a time.
+     */
+    aio_context_acquire(ctx);
+    if (plug) {
+        blk_io_plug(s->blk);
+    }
 
     do {
         if (suppress_notifications) {
@@ -786,8 +822,10 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
         virtio_blk_submit_multireq(s, &mrb);
     }
 
-    blk_io_unplug(s->blk);
-    aio_context_release(blk_get_aio_context(s->blk));
+    if (plug) {
+        blk_io_unplug(s->blk);
+    }
+    aio_context_release(ctx);
 }
 
 static void virtio_blk_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -1094,6 +1132,7 @@ static void virtio_resize_cb(void *opaque)
     VirtIODevice *vdev = opaque;
 
     assert(qemu_get_current_aio_context() == qemu_get_aio_context());
+    virtio_blk_update_nb_sectors(VIRTIO_BLK(vdev));
     virtio_notify_config(vdev);
 }
 
@@ -1213,6 +1252,7 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
 
     blk_ram_registrar_init(&s->blk_ram_registrar, s->blk);
     blk_set_dev_ops(s->blk, &virtio_block_ops, s);
+    virtio_blk_update_nb_sectors(s);
 
     blk_iostatus_enable(s->blk);
 
@@ -1281,6 +1321,8 @@ static Property virtio_blk_properties[] = {
     DEFINE_PROP_BOOL("seg-max-adjust", VirtIOBlock, conf.seg_max_adjust, true),
     DEFINE_PROP_LINK("iothread", VirtIOBlock, conf.iothread, TYPE_IOTHREAD,
                      IOThread *),
+    DEFINE_PROP_IOTHREAD_LIST("iothread-vq-mapping", VirtIOBlock,
+                              conf.iothread_vq_mapping),
     DEFINE_PROP_BIT64("discard", VirtIOBlock, host_features,
                       VIRTIO_BLK_F_DISCARD, true),
     DEFINE_PROP_BOOL("report-discard-granularity", VirtIOBlock,
@@ -15,6 +15,7 @@
 #include "hw/qdev-properties-system.h"
 #include "qapi/error.h"
 #include "qapi/visitor.h"
+#include "qapi/qapi-builtin-visit.h"
 #include "qapi/qapi-types-block.h"
 #include "qapi/qapi-types-machine.h"
 #include "qapi/qapi-types-migration.h"
@@ -1143,3 +1144,44 @@ const PropertyInfo qdev_prop_uuid = {
     .set   = set_uuid,
     .set_default_value = set_default_uuid_auto,
 };
+
+/* --- IOThread list --- */
+
+static void get_iothread_list(Object *obj, Visitor *v, const char *name,
+                              void *opaque, Error **errp)
+{
+    strList **ptr = object_field_prop_ptr(obj, opaque);
+
+    visit_type_strList(v, name, ptr, errp);
+}
+
+static void set_iothread_list(Object *obj, Visitor *v, const char *name,
+                              void *opaque, Error **errp)
+{
+    strList **ptr = object_field_prop_ptr(obj, opaque);
+    strList *list;
+
+    if (!visit_type_strList(v, name, &list, errp)) {
+        return;
+    }
+
+    qapi_free_strList(*ptr);
+    *ptr = list;
+}
+
+static void release_iothread_list(Object *obj, const char *name,
+                                  void *opaque)
+{
+    strList **ptr = object_field_prop_ptr(obj, opaque);
+
+    qapi_free_strList(*ptr);
+    *ptr = NULL;
+}
+
+const PropertyInfo qdev_prop_iothread_list = {
+    .name = "strList",
+    .description = "list of IOThread ids",
+    .get = get_iothread_list,
+    .set = set_iothread_list,
+    .release = release_iothread_list,
+};
@@ -46,6 +46,7 @@
 #include "net_rx_pkt.h"
 #include "hw/virtio/vhost.h"
 #include "sysemu/qtest.h"
+#include "sysemu/stats.h"
 
 #define VIRTIO_NET_VM_VERSION    11
 
@@ -1970,10 +1971,16 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
 
     for (j = 0; j < i; j++) {
         /* signal other side */
-        virtqueue_fill(q->rx_vq, elems[j], lens[j], j);
+        virtqueue_fill(q->rx_vq, elems[j], lens[j], q->rx_unflushed + j);
         g_free(elems[j]);
     }
 
+    if (n->rx_burst) {
+        /* Flushed and notified by virtio_net_receive_burst_end() */
+        q->rx_unflushed += i;
+        return size;
+    }
+
     virtqueue_flush(q->rx_vq, i);
     virtio_notify(vdev, q->rx_vq);
 
@@ -1996,6 +2003,38 @@ static ssize_t virtio_net_do_receive(NetClientState *nc, const uint8_t *buf,
     return virtio_net_receive_rcu(nc, buf, size, false);
 }
 
+static void virtio_net_receive_burst_begin(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+
+    n->rx_burst++;
+}
+
+static void virtio_net_receive_burst_end(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int i;
+
+    assert(n->rx_burst);
+    if (--n->rx_burst) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    /* With RSS, packets may have been steered to any of the queues */
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (q->rx_unflushed) {
+            virtqueue_flush(q->rx_vq, q->rx_unflushed);
+            q->rx_unflushed = 0;
+            virtio_notify(vdev, q->rx_vq);
+        }
+    }
+}
+
 static void virtio_net_rsc_extract_unit4(VirtioNetRscChain *chain,
                                          const uint8_t *buf,
                                          VirtioNetRscUnit *unit)
@@ -2635,6 +2674,111 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+
+/* Packets that virtio_net_flush_tx() hands to the peer in one go */
+#define VIRTIO_NET_TX_BATCH     64
+#define VIRTIO_NET_TX_BATCH_IOV VIRTQUEUE_MAX_SIZE
+
+QEMU_BUILD_BUG_ON(VIRTIO_NET_TX_BATCH >= 1 << VIRTIO_NET_TX_BURST_HIST);
+
+struct VirtIONetTxBatch {
+    VirtQueueElement *elems[VIRTIO_NET_TX_BATCH];
+    NetBatchPacket pkts[VIRTIO_NET_TX_BATCH];
+    /*
+     * Copies of iovecs that differ from the element's out_sg.  Any single
+     * packet fits, see the size of sg[] in virtio_net_flush_tx().
+     */
+    struct iovec iov[VIRTIO_NET_TX_BATCH_IOV];
+    unsigned num;
+    unsigned num_iov;
+};
+
+/*
+ * Returns false if the packet does not fit into the batch anymore.  The
+ * iovecs are copied unless they are the element's own out_sg.
+ */
+static bool virtio_net_tx_batch_add(VirtIONetTxBatch *b, VirtQueueElement *elem,
+                                    const struct iovec *out_sg,
+                                    unsigned out_num)
+{
+    NetBatchPacket *pkt;
+
+    if (b->num == VIRTIO_NET_TX_BATCH) {
+        return false;
+    }
+    if (out_sg != elem->out_sg) {
+        if (out_num > VIRTIO_NET_TX_BATCH_IOV - b->num_iov) {
+            return false;
+        }
+        memcpy(&b->iov[b->num_iov], out_sg, out_num * sizeof(*out_sg));
+        out_sg = &b->iov[b->num_iov];
+        b->num_iov += out_num;
+    }
+
+    pkt = &b->pkts[b->num];
+    pkt->iov = out_sg;
+    pkt->iovcnt = out_num;
+    b->elems[b->num++] = elem;
+    return true;
+}
+
+/*
+ * Send the batched packets and complete them with a single update of the
+ * used ring.  Returns -EBUSY if the net layer had to queue one of them.  That
+ * one is then completed by virtio_net_tx_complete(), and the packets after
+ * it are put back into the virtqueue.
+ */
+static int virtio_net_tx_batch_submit(VirtIONetQueue *q)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtIONetTxBatch *b = q->tx_batch;
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    NetClientState *nc = qemu_get_subqueue(n->nic, queue_index);
+    unsigned i, done;
+    int sent, ret = 0;
+
+    if (!b->num) {
+        return 0;
+    }
+
+    sent = qemu_sendv_packet_batch(nc, b->pkts, b->num);
+    for (done = sent; done < b->num; done++) {
+        if (qemu_sendv_packet_async(nc, b->pkts[done].iov,
+                                    b->pkts[done].iovcnt,
+                                    virtio_net_tx_complete) == 0) {
+            virtio_queue_set_notification(q->tx_vq, 0);
+            q->async_tx.elem = b->elems[done];
+            ret = -EBUSY;
+            break;
+        }
+    }
+    trace_virtio_net_tx_batch(queue_index, b->num, sent);
+    n->tx_burst_hist[32 - clz32(b->num)]++;
+
+    if (ret == -EBUSY) {
+        for (i = b->num - 1; i > done; i--) {
+            virtqueue_unpop(q->tx_vq, b->elems[i], 0);
+            g_free(b->elems[i]);
+        }
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        for (i = 0; i < done; i++) {
+            virtqueue_fill(q->tx_vq, b->elems[i], 0, i);
+            g_free(b->elems[i]);
+        }
+        if (done) {
+            virtqueue_flush(q->tx_vq, done);
+            virtio_notify(vdev, q->tx_vq);
+        }
+    }
+
+    b->num = 0;
+    b->num_iov = 0;
+    return ret;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
@@ -2668,6 +2812,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             virtio_error(vdev, "virtio-net header not in first element");
             virtqueue_detach_element(q->tx_vq, elem, 0);
             g_free(elem);
+            virtio_net_tx_batch_submit(q);
             return -EINVAL;
         }
 
@@ -2677,6 +2822,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                 virtio_error(vdev, "virtio-net header incorrect");
                 virtqueue_detach_element(q->tx_vq, elem, 0);
                 g_free(elem);
+                virtio_net_tx_batch_submit(q);
                 return -EINVAL;
             }
             if (n->needs_vnet_hdr_swap) {
@@ -2710,6 +2856,20 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             out_sg = sg;
         }
 
+        /* A swapped header lives in mhdr, which the next packet reuses */
+        if (!n->needs_vnet_hdr_swap) {
+            if (!virtio_net_tx_batch_add(q->tx_batch, elem, out_sg, out_num)) {
+                /* The batch is full, send it and start a new one */
+                if (virtio_net_tx_batch_submit(q) < 0) {
+                    virtqueue_unpop(q->tx_vq, elem, 0);
+                    g_free(elem);
+                    return -EBUSY;
+                }
+                virtio_net_tx_batch_add(q->tx_batch, elem, out_sg, out_num);
+            }
+            goto next;
+        }
+
         ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
                                       out_sg, out_num, virtio_net_tx_complete);
         if (ret == 0) {
@@ -2723,10 +2883,15 @@ drop:
         virtio_notify(vdev, q->tx_vq);
         g_free(elem);
 
+next:
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
+
+    if (virtio_net_tx_batch_submit(q) < 0) {
+        return -EBUSY;
+    }
     return num_packets;
 }
 
@@ -2903,6 +3068,7 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
         n->vqs[index].tx_bh = qemu_bh_new(virtio_net_tx_bh, &n->vqs[index]);
     }
 
+    n->vqs[index].tx_batch = g_new0(VirtIONetTxBatch, 1);
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
 }
@@ -2924,6 +3090,8 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
         q->tx_bh = NULL;
     }
     q->tx_waiting = 0;
+    g_free(q->tx_batch);
+    q->tx_batch = NULL;
     virtio_del_queue(vdev, index * 2 + 1);
 }
 
@@ -3316,6 +3484,8 @@ static NetClientInfo net_virtio_info = {
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .receive_burst_begin = virtio_net_receive_burst_begin,
+    .receive_burst_end = virtio_net_receive_burst_end,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
@@ -3905,6 +4075,76 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
+typedef struct VirtIONetStatsArgs {
+    StatsResultList **result;
+    strList *names;
+} VirtIONetStatsArgs;
+
+static int virtio_net_stats_query(Object *obj, void *opaque)
+{
+    VirtIONetStatsArgs *stats_args = opaque;
+    g_autofree char *qom_path = NULL;
+    VirtIONet *n;
+    Stats *stats;
+    StatsList *stats_list = NULL;
+    uint64List *hist = NULL;
+    int i;
+
+    if (!object_dynamic_cast(obj, TYPE_VIRTIO_NET)) {
+        return 0;
+    }
+    if (!apply_str_list_filter("tx-burst", stats_args->names)) {
+        return 0;
+    }
+
+    n = VIRTIO_NET(obj);
+    for (i = VIRTIO_NET_TX_BURST_HIST - 1; i >= 0; i--) {
+        QAPI_LIST_PREPEND(hist, n->tx_burst_hist[i]);
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup("tx-burst");
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QLIST;
+    stats->value->u.list = hist;
+    QAPI_LIST_PREPEND(stats_list, stats);
+
+    qom_path = object_get_canonical_path(obj);
+    add_stats_entry(stats_args->result, STATS_PROVIDER_VIRTIO_NET, qom_path,
+                    stats_list);
+    return 0;
+}
+
+static void virtio_net_stats_cb(StatsResultList **result, StatsTarget target,
+                                strList *names, strList *targets,
+                                Error **errp)
+{
+    VirtIONetStatsArgs stats_args = {
+        .result = result,
+        .names = names,
+    };
+
+    if (target != STATS_TARGET_VIRTIO_NET) {
+        return;
+    }
+
+    object_child_foreach_recursive(object_get_root(), virtio_net_stats_query,
+                                   &stats_args);
+}
+
+static void virtio_net_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup("tx-burst");
+    value->type = STATS_TYPE_LOG2_HISTOGRAM;
+    QAPI_LIST_PREPEND(stats_list, value);
+
+    add_stats_schema(result, STATS_PROVIDER_VIRTIO_NET,
+                     STATS_TARGET_VIRTIO_NET, stats_list);
+}
+
 static void virtio_net_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
@@ -3931,6 +4171,9 @@ static void virtio_net_class_init(ObjectClass *klass, void *data)
     vdc->vmsd = &vmstate_virtio_net_device;
     vdc->primary_unplug_pending = primary_unplug_pending;
     vdc->get_vhost = virtio_net_get_vhost;
+
+    add_stats_callbacks(STATS_PROVIDER_VIRTIO_NET, virtio_net_stats_cb,
+                        virtio_net_schemas_cb);
 }
 
 static const TypeInfo virtio_net_info = {
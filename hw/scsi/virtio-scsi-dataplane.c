@@ -21,6 +21,55 @@
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
 
+/* Context: QEMU global mutex held */
+static bool virtio_scsi_setup_vq_iothreads(VirtIOSCSI *s, Error **errp)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    strList *node;
+    unsigned i;
+
+    if (!vs->conf.iothread_vq_mapping) {
+        return true;
+    }
+
+    for (node = vs->conf.iothread_vq_mapping; node; node = node->next) {
+        IOThread *iothread = iothread_by_id(node->value);
+
+        if (!iothread) {
+            error_setg(errp, "IOThread \"%s\" object not found", node->value);
+            virtio_scsi_dataplane_cleanup(s);
+            return false;
+        }
+        object_ref(OBJECT(iothread));
+        s->vq_iothreads = g_renew(IOThread *, s->vq_iothreads,
+                                  s->num_vq_iothreads + 1);
+        s->vq_iothreads[s->num_vq_iothreads++] = iothread;
+    }
+
+    s->cmd_vq_ctx = g_new(AioContext *, vs->conf.num_queues);
+    for (i = 0; i < vs->conf.num_queues; i++) {
+        IOThread *iothread = s->vq_iothreads[i % s->num_vq_iothreads];
+
+        s->cmd_vq_ctx[i] = iothread_get_aio_context(iothread);
+    }
+    return true;
+}
+
+/* Context: QEMU global mutex held */
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s)
+{
+    unsigned i;
+
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        object_unref(OBJECT(s->vq_iothreads[i]));
+    }
+    g_free(s->vq_iothreads);
+    s->vq_iothreads = NULL;
+    s->num_vq_iothreads = 0;
+    g_free(s->cmd_vq_ctx);
+    s->cmd_vq_ctx = NULL;
+}
+
 /* Context: QEMU global mutex held */
 void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
 {
@@ -29,7 +78,7 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
 
-    if (vs->conf.iothread) {
+    if (vs->conf.iothread || vs->conf.iothread_vq_mapping) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -40,7 +89,15 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
             error_setg(errp, "ioeventfd is required for iothread");
             return;
         }
-        s->ctx = iothread_get_aio_context(vs->conf.iothread);
+        if (!virtio_scsi_setup_vq_iothreads(s, errp)) {
+            return;
+        }
+        /*
+         * Without an explicit iothread, the control and event virtqueues go
+         * to the first IOThread of iothread-vq-mapping.
+         */
+        s->ctx = iothread_get_aio_context(vs->conf.iothread ?:
+                                          s->vq_iothreads[0]);
     } else {
         if (!virtio_device_ioeventfd_enabled(vdev)) {
             return;
@@ -66,17 +123,27 @@ static int virtio_scsi_set_host_notifier(VirtIOSCSI *s, VirtQueue *vq, int n)
     return 0;
 }
 
-/* Context: BH in IOThread */
+static AioContext *virtio_scsi_cmd_vq_ctx(VirtIOSCSI *s, int i)
+{
+    return s->cmd_vq_ctx ? s->cmd_vq_ctx[i] : s->ctx;
+}
+
+/* Context: BH in IOThread, for each AioContext that services virtqueues */
 static void virtio_scsi_dataplane_stop_bh(void *opaque)
 {
     VirtIOSCSI *s = opaque;
     VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    AioContext *ctx = qemu_get_current_aio_context();
     int i;
 
-    virtio_queue_aio_detach_host_notifier(vs->ctrl_vq, s->ctx);
-    virtio_queue_aio_detach_host_notifier(vs->event_vq, s->ctx);
+    if (ctx == s->ctx) {
+        virtio_queue_aio_detach_host_notifier(vs->ctrl_vq, s->ctx);
+        virtio_queue_aio_detach_host_notifier(vs->event_vq, s->ctx);
+    }
     for (i = 0; i < vs->conf.num_queues; i++) {
-        virtio_queue_aio_detach_host_notifier(vs->cmd_vqs[i], s->ctx);
+        if (virtio_scsi_cmd_vq_ctx(s, i) == ctx) {
+            virtio_queue_aio_detach_host_notifier(vs->cmd_vqs[i], ctx);
+        }
     }
 }
 
@@ -147,11 +214,25 @@ int virtio_scsi_dataplane_start(VirtIODevice *vdev)
     aio_context_acquire(s->ctx);
     virtio_queue_aio_attach_host_notifier(vs->ctrl_vq, s->ctx);
     virtio_queue_aio_attach_host_notifier_no_poll(vs->event_vq, s->ctx);
+    aio_context_release(s->ctx);
 
     for (i = 0; i < vs->conf.num_queues; i++) {
-        virtio_queue_aio_attach_host_notifier(vs->cmd_vqs[i], s->ctx);
+        AioContext *ctx = virtio_scsi_cmd_vq_ctx(s, i);
+
+        aio_context_acquire(ctx);
+        if (s->cmd_vq_ctx) {
+            /*
+             * Requests are completed in the AioContext of their LUN, which
+             * need not be this one.  The polling callbacks would touch the
+             * virtqueue without holding its lock, so do without them.
+             */
+            virtio_queue_aio_attach_host_notifier_no_poll(vs->cmd_vqs[i],
+                                                          ctx);
+        } else {
+            virtio_queue_aio_attach_host_notifier(vs->cmd_vqs[i], ctx);
+        }
+        aio_context_release(ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
 fail_host_notifiers:
@@ -197,6 +278,16 @@ void virtio_scsi_dataplane_stop(VirtIODevice *vdev)
     }
     s->dataplane_stopping = true;
 
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        AioContext *ctx = iothread_get_aio_context(s->vq_iothreads[i]);
+
+        if (ctx != s->ctx) {
+            aio_context_acquire(ctx);
+            aio_wait_bh_oneshot(ctx, virtio_scsi_dataplane_stop_bh, s);
+            aio_context_release(ctx);
+        }
+    }
+
     aio_context_acquire(s->ctx);
     aio_wait_bh_oneshot(s->ctx, virtio_scsi_dataplane_stop_bh, s);
     aio_context_release(s->ctx);
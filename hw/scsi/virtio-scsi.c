@@ -24,6 +24,7 @@
 #include "sysemu/block-backend.h"
 #include "sysemu/dma.h"
 #include "hw/qdev-properties.h"
+#include "hw/qdev-properties-system.h"
 #include "hw/scsi/scsi.h"
 #include "scsi/constants.h"
 #include "hw/virtio/virtio-bus.h"
@@ -46,6 +47,9 @@ typedef struct VirtIOSCSIReq {
     /* Used for two-stage request submission and TMFs deferred to BH */
     QTAILQ_ENTRY(VirtIOSCSIReq) next;
 
+    /* LUN of a command that is handed over to the LUN's AioContext */
+    SCSIDevice *lun_dev;
+
     /* Used for cancellation of request during TMFs */
     int remaining;
 
@@ -101,6 +105,46 @@ static void virtio_scsi_free_req(VirtIOSCSIReq *req)
     g_free(req);
 }
 
+/* vq_locks only exists with iothread-vq-mapping, see VirtIOSCSI */
+static void virtio_scsi_vq_lock(VirtIOSCSI *s, VirtQueue *vq)
+{
+    if (s->vq_locks) {
+        qemu_mutex_lock(&s->vq_locks[virtio_get_queue_index(vq)]);
+    }
+}
+
+static void virtio_scsi_vq_unlock(VirtIOSCSI *s, VirtQueue *vq)
+{
+    if (s->vq_locks) {
+        qemu_mutex_unlock(&s->vq_locks[virtio_get_queue_index(vq)]);
+    }
+}
+
+static void virtio_scsi_set_notification(VirtIOSCSI *s, VirtQueue *vq,
+                                         int enable)
+{
+    virtio_scsi_vq_lock(s, vq);
+    virtio_queue_set_notification(vq, enable);
+    virtio_scsi_vq_unlock(s, vq);
+}
+
+static bool virtio_scsi_vq_empty(VirtIOSCSI *s, VirtQueue *vq)
+{
+    bool empty;
+
+    virtio_scsi_vq_lock(s, vq);
+    empty = virtio_queue_empty(vq);
+    virtio_scsi_vq_unlock(s, vq);
+    return empty;
+}
+
+static void virtio_scsi_detach_req(VirtIOSCSIReq *req)
+{
+    virtio_scsi_vq_lock(req->dev, req->vq);
+    virtqueue_detach_element(req->vq, &req->elem, 0);
+    virtio_scsi_vq_unlock(req->dev, req->vq);
+}
+
 static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
 {
     VirtIOSCSI *s = req->dev;
@@ -108,12 +152,14 @@ static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
 
     qemu_iovec_from_buf(&req->resp_iov, 0, &req->resp, req->resp_size);
+    virtio_scsi_vq_lock(s, vq);
     virtqueue_push(vq, &req->elem, req->qsgl.size + req->resp_iov.size);
     if (s->dataplane_started && !s->dataplane_fenced) {
         virtio_notify_irqfd(vdev, vq);
     } else {
         virtio_notify(vdev, vq);
     }
+    virtio_scsi_vq_unlock(s, vq);
 
     if (req->sreq) {
         req->sreq->hba_private = NULL;
@@ -125,7 +171,7 @@ static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
 static void virtio_scsi_bad_req(VirtIOSCSIReq *req)
 {
     virtio_error(VIRTIO_DEVICE(req->dev), "wrong size for virtio-scsi headers");
-    virtqueue_detach_element(req->vq, &req->elem, 0);
+    virtio_scsi_detach_req(req);
     virtio_scsi_free_req(req);
 }
 
@@ -215,7 +261,9 @@ static VirtIOSCSIReq *virtio_scsi_pop_req(VirtIOSCSI *s, VirtQueue *vq)
     VirtIOSCSICommon *vs = (VirtIOSCSICommon *)s;
     VirtIOSCSIReq *req;
 
+    virtio_scsi_vq_lock(s, vq);
     req = virtqueue_pop(vq, sizeof(VirtIOSCSIReq) + vs->cdb_size);
+    virtio_scsi_vq_unlock(s, vq);
     if (!req) {
         return NULL;
     }
@@ -287,9 +335,26 @@ static void virtio_scsi_cancel_notify(Notifier *notifier, void *data)
 
 static inline void virtio_scsi_ctx_check(VirtIOSCSI *s, SCSIDevice *d)
 {
-    if (s->dataplane_started && d && blk_is_available(d->conf.blk)) {
-        assert(blk_get_aio_context(d->conf.blk) == s->ctx);
+    AioContext *ctx;
+    unsigned i;
+
+    if (!s->dataplane_started || !d || !blk_is_available(d->conf.blk)) {
+        return;
+    }
+
+    ctx = blk_get_aio_context(d->conf.blk);
+    if (!s->num_vq_iothreads) {
+        assert(ctx == s->ctx);
+        return;
+    }
+
+    /* LUNs are spread over the IOThreads of iothread-vq-mapping */
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        if (ctx == iothread_get_aio_context(s->vq_iothreads[i])) {
+            return;
+        }
     }
+    g_assert_not_reached();
 }
 
 static void virtio_scsi_do_one_tmf_bh(VirtIOSCSIReq *req)
@@ -414,10 +479,17 @@ static void virtio_scsi_defer_tmf_to_bh(VirtIOSCSIReq *req)
 static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
 {
     SCSIDevice *d = virtio_scsi_device_get(s, req->req.tmf.lun);
+    AioContext *lun_ctx = NULL;
     SCSIRequest *r, *next;
     int ret = 0;
 
     virtio_scsi_ctx_check(s, d);
+
+    /* With iothread-vq-mapping, the LUN may live in another AioContext */
+    if (d) {
+        lun_ctx = blk_get_aio_context(d->conf.blk);
+        aio_context_acquire(lun_ctx);
+    }
     /* Here VIRTIO_SCSI_S_OK means "FUNCTION COMPLETE".  */
     req->resp.tmf.response = VIRTIO_SCSI_S_OK;
 
@@ -522,18 +594,20 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
         break;
     }
 
+out:
+    if (lun_ctx) {
+        aio_context_release(lun_ctx);
+    }
     object_unref(OBJECT(d));
     return ret;
 
 incorrect_lun:
     req->resp.tmf.response = VIRTIO_SCSI_S_INCORRECT_LUN;
-    object_unref(OBJECT(d));
-    return ret;
+    goto out;
 
 fail:
     req->resp.tmf.response = VIRTIO_SCSI_S_BAD_TARGET;
-    object_unref(OBJECT(d));
-    return ret;
+    goto out;
 }
 
 static void virtio_scsi_handle_ctrl_req(VirtIOSCSI *s, VirtIOSCSIReq *req)
@@ -759,32 +833,11 @@ static void virtio_scsi_fail_cmd_req(VirtIOSCSIReq *req)
     virtio_scsi_complete_cmd_req(req);
 }
 
-static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
+static int virtio_scsi_handle_cmd_req_new(VirtIOSCSI *s, VirtIOSCSIReq *req,
+                                          SCSIDevice *d)
 {
     VirtIOSCSICommon *vs = &s->parent_obj;
-    SCSIDevice *d;
-    int rc;
 
-    rc = virtio_scsi_parse_req(req, sizeof(VirtIOSCSICmdReq) + vs->cdb_size,
-                               sizeof(VirtIOSCSICmdResp) + vs->sense_size);
-    if (rc < 0) {
-        if (rc == -ENOTSUP) {
-            virtio_scsi_fail_cmd_req(req);
-            return -ENOTSUP;
-        } else {
-            virtio_scsi_bad_req(req);
-            return -EINVAL;
-        }
-    }
-    trace_virtio_scsi_cmd_req(virtio_scsi_get_lun(req->req.cmd.lun),
-                              req->req.cmd.tag, req->req.cmd.cdb[0]);
-
-    d = virtio_scsi_device_get(s, req->req.cmd.lun);
-    if (!d) {
-        req->resp.cmd.response = VIRTIO_SCSI_S_BAD_TARGET;
-        virtio_scsi_complete_cmd_req(req);
-        return -ENOENT;
-    }
     virtio_scsi_ctx_check(s, d);
     req->sreq = scsi_req_new(d, req->req.cmd.tag,
                              virtio_scsi_get_lun(req->req.cmd.lun),
@@ -795,12 +848,10 @@ static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
             req->sreq->cmd.xfer > req->qsgl.size)) {
         req->resp.cmd.response = VIRTIO_SCSI_S_OVERRUN;
         virtio_scsi_complete_cmd_req(req);
-        object_unref(OBJECT(d));
         return -ENOBUFS;
     }
     scsi_req_ref(req->sreq);
     blk_io_plug(d->conf.blk);
-    object_unref(OBJECT(d));
     return 0;
 }
 
@@ -814,6 +865,88 @@ static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
     scsi_req_unref(sreq);
 }
 
+/* Context: BH in the AioContext of the LUN */
+static void virtio_scsi_handle_cmd_req_bh(void *opaque)
+{
+    VirtIOSCSIReq *req = opaque;
+    VirtIOSCSI *s = req->dev;
+    SCSIDevice *d = req->lun_dev;
+    BlockBackend *blk = d->conf.blk;
+    AioContext *ctx = blk_get_aio_context(blk);
+
+    req->lun_dev = NULL;
+
+    aio_context_acquire(ctx);
+    if (!virtio_scsi_handle_cmd_req_new(s, req, d)) {
+        virtio_scsi_handle_cmd_req_submit(s, req);
+    }
+    blk_dec_in_flight(blk);
+    aio_context_release(ctx);
+
+    object_unref(OBJECT(d));
+}
+
+/*
+ * With iothread-vq-mapping, a virtqueue may be serviced by another thread
+ * than the LUN.  The LUN's block layer state may only be touched from its
+ * own AioContext, so hand the command over.  The reference to @d is passed
+ * on, and the in-flight counter keeps draining from completing before the
+ * command was submitted.
+ */
+static bool virtio_scsi_handoff_cmd_req(VirtIOSCSI *s, VirtIOSCSIReq *req,
+                                        SCSIDevice *d)
+{
+    AioContext *ctx;
+
+    if (!s->num_vq_iothreads) {
+        return false;
+    }
+
+    ctx = blk_get_aio_context(d->conf.blk);
+    if (ctx == qemu_get_current_aio_context()) {
+        return false;
+    }
+
+    req->lun_dev = d;
+    blk_inc_in_flight(d->conf.blk);
+    aio_bh_schedule_oneshot(ctx, virtio_scsi_handle_cmd_req_bh, req);
+    return true;
+}
+
+static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
+{
+    VirtIOSCSICommon *vs = &s->parent_obj;
+    SCSIDevice *d;
+    int rc;
+
+    rc = virtio_scsi_parse_req(req, sizeof(VirtIOSCSICmdReq) + vs->cdb_size,
+                               sizeof(VirtIOSCSICmdResp) + vs->sense_size);
+    if (rc < 0) {
+        if (rc == -ENOTSUP) {
+            virtio_scsi_fail_cmd_req(req);
+            return -ENOTSUP;
+        } else {
+            virtio_scsi_bad_req(req);
+            return -EINVAL;
+        }
+    }
+    trace_virtio_scsi_cmd_req(virtio_scsi_get_lun(req->req.cmd.lun),
+                              req->req.cmd.tag, req->req.cmd.cdb[0]);
+
+    d = virtio_scsi_device_get(s, req->req.cmd.lun);
+    if (!d) {
+        req->resp.cmd.response = VIRTIO_SCSI_S_BAD_TARGET;
+        virtio_scsi_complete_cmd_req(req);
+        return -ENOENT;
+    }
+    if (virtio_scsi_handoff_cmd_req(s, req, d)) {
+        return -EINPROGRESS;
+    }
+    rc = virtio_scsi_handle_cmd_req_new(s, req, d);
+    object_unref(OBJECT(d));
+    return rc;
+}
+
 static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
 {
     VirtIOSCSIReq *req, *next;
@@ -824,7 +957,7 @@ static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
 
     do {
         if (suppress_notifications) {
-            virtio_queue_set_notification(vq, 0);
+            virtio_scsi_set_notification(s, vq, 0);
         }
 
         while ((req = virtio_scsi_pop_req(s, vq))) {
@@ -838,16 +971,16 @@ static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
                     QTAILQ_REMOVE(&reqs, req, next);
                     blk_io_unplug(req->sreq->dev->conf.blk);
                     scsi_req_unref(req->sreq);
-                    virtqueue_detach_element(req->vq, &req->elem, 0);
+                    virtio_scsi_detach_req(req);
                     virtio_scsi_free_req(req);
                 }
             }
         }
 
         if (suppress_notifications) {
-            virtio_queue_set_notification(vq, 1);
+            virtio_scsi_set_notification(s, vq, 1);
         }
-    } while (ret != -EINVAL && !virtio_queue_empty(vq));
+    } while (ret != -EINVAL && !virtio_scsi_vq_empty(s, vq));
 
     QTAILQ_FOREACH_SAFE(req, &reqs, next, next) {
         virtio_scsi_handle_cmd_req_submit(s, req);
@@ -858,14 +991,27 @@ static void virtio_scsi_handle_cmd(VirtIODevice *vdev, VirtQueue *vq)
 {
     /* use non-QOM casts in the data path */
     VirtIOSCSI *s = (VirtIOSCSI *)vdev;
+    AioContext *ctx;
 
     if (virtio_scsi_defer_to_dataplane(s)) {
         return;
     }
 
-    virtio_scsi_acquire(s);
+    if (!s->num_vq_iothreads) {
+        virtio_scsi_acquire(s);
+        virtio_scsi_handle_cmd_vq(s, vq);
+        virtio_scsi_release(s);
+        return;
+    }
+
+    /*
+     * Only LUNs of this thread's AioContext are handled here, the others get
+     * their commands handed over, see virtio_scsi_handoff_cmd_req().
+     */
+    ctx = qemu_get_current_aio_context();
+    aio_context_acquire(ctx);
     virtio_scsi_handle_cmd_vq(s, vq);
-    virtio_scsi_release(s);
+    aio_context_release(ctx);
 }
 
 static void virtio_scsi_get_config(VirtIODevice *vdev,
@@ -1023,6 +1169,23 @@ static void virtio_scsi_pre_hotplug(HotplugHandler *hotplug_dev,
     sd->hba_supports_iothread = true;
 }
 
+/*
+ * Spread LUNs over the IOThreads of iothread-vq-mapping, so that their block
+ * I/O does not all run in a single thread.
+ *
+ * Context: QEMU global mutex held
+ */
+static AioContext *virtio_scsi_next_lun_ctx(VirtIOSCSI *s)
+{
+    IOThread *iothread;
+
+    if (!s->num_vq_iothreads) {
+        return s->ctx;
+    }
+    iothread = s->vq_iothreads[s->next_lun_iothread++ % s->num_vq_iothreads];
+    return iothread_get_aio_context(iothread);
+}
+
 static void virtio_scsi_hotplug(HotplugHandler *hotplug_dev, DeviceState *dev,
                                 Error **errp)
 {
@@ -1038,7 +1201,8 @@ static void virtio_scsi_hotplug(HotplugHandler *hotplug_dev, DeviceState *dev,
         }
         old_context = blk_get_aio_context(sd->conf.blk);
         aio_context_acquire(old_context);
-        ret = blk_set_aio_context(sd->conf.blk, s->ctx, errp);
+        ret = blk_set_aio_context(sd->conf.blk, virtio_scsi_next_lun_ctx(s),
+                                  errp);
         aio_context_release(old_context);
         if (ret < 0) {
             return;
@@ -1062,6 +1226,7 @@ static void virtio_scsi_hotunplug(HotplugHandler *hotplug_dev, DeviceState *dev,
     VirtIOSCSI *s = VIRTIO_SCSI(vdev);
     SCSIDevice *sd = SCSI_DEVICE(dev);
     AioContext *ctx = s->ctx ?: qemu_get_aio_context();
+    unsigned i;
 
     if (virtio_vdev_has_feature(vdev, VIRTIO_SCSI_F_HOTPLUG)) {
         virtio_scsi_acquire(s);
@@ -1072,15 +1237,24 @@ static void virtio_scsi_hotunplug(HotplugHandler *hotplug_dev, DeviceState *dev,
         virtio_scsi_release(s);
     }
 
+    /* Command virtqueues may be serviced by other IOThreads, too */
     aio_disable_external(ctx);
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        aio_disable_external(iothread_get_aio_context(s->vq_iothreads[i]));
+    }
     qdev_simple_device_unplug_cb(hotplug_dev, dev, errp);
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        aio_enable_external(iothread_get_aio_context(s->vq_iothreads[i]));
+    }
     aio_enable_external(ctx);
 
     if (s->ctx) {
-        virtio_scsi_acquire(s);
+        AioContext *old_context = blk_get_aio_context(sd->conf.blk);
+
+        aio_context_acquire(old_context);
         /* If other users keep the BlockBackend in the iothread, that's ok */
         blk_set_aio_context(sd->conf.blk, qemu_get_aio_context(), NULL);
-        virtio_scsi_release(s);
+        aio_context_release(old_context);
     }
 }
 
@@ -1144,7 +1318,9 @@ static void virtio_scsi_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOSCSI *s = VIRTIO_SCSI(dev);
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(dev);
     Error *err = NULL;
+    int i;
 
     QTAILQ_INIT(&s->tmf_bh_list);
 
@@ -1164,6 +1340,14 @@ static void virtio_scsi_device_realize(DeviceState *dev, Error **errp)
     qbus_set_hotplug_handler(BUS(&s->bus), OBJECT(dev));
 
     virtio_scsi_dataplane_setup(s, errp);
+
+    if (s->num_vq_iothreads) {
+        s->vq_locks = g_new(QemuMutex,
+                            vs->conf.num_queues + VIRTIO_SCSI_VQ_NUM_FIXED);
+        for (i = 0; i < vs->conf.num_queues + VIRTIO_SCSI_VQ_NUM_FIXED; i++) {
+            qemu_mutex_init(&s->vq_locks[i]);
+        }
+    }
 }
 
 void virtio_scsi_common_unrealize(DeviceState *dev)
@@ -1184,10 +1368,20 @@ void virtio_scsi_common_unrealize(DeviceState *dev)
 static void virtio_scsi_device_unrealize(DeviceState *dev)
 {
     VirtIOSCSI *s = VIRTIO_SCSI(dev);
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(dev);
+    int i;
 
     virtio_scsi_reset_tmf_bh(s);
 
     qbus_set_hotplug_handler(BUS(&s->bus), NULL);
+    virtio_scsi_dataplane_cleanup(s);
+    if (s->vq_locks) {
+        for (i = 0; i < vs->conf.num_queues + VIRTIO_SCSI_VQ_NUM_FIXED; i++) {
+            qemu_mutex_destroy(&s->vq_locks[i]);
+        }
+        g_free(s->vq_locks);
+        s->vq_locks = NULL;
+    }
     virtio_scsi_common_unrealize(dev);
 }
 
@@ -1208,6 +1402,8 @@ static Property virtio_scsi_properties[] = {
                                                 VIRTIO_SCSI_F_CHANGE, true),
     DEFINE_PROP_LINK("iothread", VirtIOSCSI, parent_obj.conf.iothread,
                      TYPE_IOTHREAD, IOThread *),
+    DEFINE_PROP_IOTHREAD_LIST("iothread-vq-mapping", VirtIOSCSI,
+                              parent_obj.conf.iothread_vq_mapping),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -331,6 +331,22 @@ static void vfio_state_pending_exact(void *opaque, uint64_t *must_precopy,
                                    stop_copy_size);
 }
 
+/*
+ * The device data is part of the pending state above.  What comes on top
+ * at switchover is the config state, see vfio_save_device_config_state().
+ */
+static uint64_t vfio_state_switchover_estimate(void *opaque)
+{
+    VFIODevice *vbasedev = opaque;
+    uint64_t size = 2 * sizeof(uint64_t);
+
+    if (vbasedev->ops && vbasedev->ops->vfio_config_size) {
+        size += vbasedev->ops->vfio_config_size(vbasedev);
+    }
+
+    return size;
+}
+
 static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
 {
     VFIODevice *vbasedev = opaque;
@@ -456,6 +472,7 @@ static const SaveVMHandlers savevm_vfio_handlers = {
     .save_setup = vfio_save_setup,
     .save_cleanup = vfio_save_cleanup,
     .state_pending_exact = vfio_state_pending_exact,
+    .state_switchover_estimate = vfio_state_switchover_estimate,
     .save_live_complete_precopy = vfio_save_complete_precopy,
     .save_state = vfio_save_state,
     .load_setup = vfio_load_setup,
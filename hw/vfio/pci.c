@@ -2495,6 +2495,20 @@ static void vfio_pci_save_config(VFIODevice *vbasedev, QEMUFile *f)
     vmstate_save_state(f, &vmstate_vfio_pci_config, vdev, NULL);
 }
 
+/* Size of what vfio_pci_save_config() writes, give or take a few fields */
+static uint64_t vfio_pci_config_size(VFIODevice *vbasedev)
+{
+    VFIOPCIDevice *vdev = container_of(vbasedev, VFIOPCIDevice, vbasedev);
+    PCIDevice *pdev = &vdev->pdev;
+    uint64_t size = pci_config_size(pdev);
+
+    if (msix_present(pdev)) {
+        size += pdev->msix_entries_nr * PCI_MSIX_ENTRY_SIZE +
+                DIV_ROUND_UP(pdev->msix_entries_nr, 8);
+    }
+    return size;
+}
+
 static int vfio_pci_load_config(VFIODevice *vbasedev, QEMUFile *f)
 {
     VFIOPCIDevice *vdev = container_of(vbasedev, VFIOPCIDevice, vbasedev);
@@ -2541,6 +2555,7 @@ static VFIODeviceOps vfio_pci_ops = {
     .vfio_eoi = vfio_intx_eoi,
     .vfio_get_object = vfio_pci_get_object,
     .vfio_save_config = vfio_pci_save_config,
+    .vfio_config_size = vfio_pci_config_size,
     .vfio_load_config = vfio_pci_load_config,
 };
 
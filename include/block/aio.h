@@ -221,6 +221,9 @@ struct AioContext {
      */
     struct LuringState *linux_io_uring;
 
+    /* Same, for the ring that polls for completions (IORING_SETUP_IOPOLL) */
+    struct LuringState *linux_io_uring_iopoll;
+
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
@@ -532,6 +535,13 @@ struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+/* Setup the polled-completion LuringState bound to this AioContext */
+struct LuringState *aio_setup_linux_io_uring_iopoll(AioContext *ctx,
+                                                    Error **errp);
+
+/* Return the polled-completion LuringState bound to this AioContext */
+struct LuringState *aio_get_linux_io_uring_iopoll(AioContext *ctx);
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -74,6 +74,15 @@ struct RAMBlock {
      * could not have been valid on the source.
      */
     ram_addr_t postcopy_length;
+
+    /*
+     * For mapped-ram migration: bitmap of the pages present in the
+     * file, the offset of that bitmap in the file, and the offset of
+     * the block's page region, which has room for used_length bytes.
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    uint64_t pages_offset;
 };
 #endif
 #endif
@@ -32,6 +32,7 @@ typedef struct BlockConf {
     OnOffAuto wce;
     bool share_rw;
     OnOffAuto account_invalid, account_failed;
+    bool request_merging;
     BlockdevOnError rerror;
     BlockdevOnError werror;
 } BlockConf;
@@ -66,7 +67,9 @@ static inline unsigned int get_physical_block_exp(BlockConf *conf)
     DEFINE_PROP_ON_OFF_AUTO("account-invalid", _state,                  \
                             _conf.account_invalid, ON_OFF_AUTO_AUTO),   \
     DEFINE_PROP_ON_OFF_AUTO("account-failed", _state,                   \
-                            _conf.account_failed, ON_OFF_AUTO_AUTO)
+                            _conf.account_failed, ON_OFF_AUTO_AUTO),    \
+    DEFINE_PROP_BOOL("x-request-merging", _state,                       \
+                     _conf.request_merging, false)
 
 #define DEFINE_BLOCK_PROPERTIES(_state, _conf)                          \
     DEFINE_PROP_DRIVE("drive", _state, _conf.blk),                      \
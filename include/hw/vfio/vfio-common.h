@@ -153,6 +153,7 @@ struct VFIODeviceOps {
     void (*vfio_eoi)(VFIODevice *vdev);
     Object *(*vfio_get_object)(VFIODevice *vdev);
     void (*vfio_save_config)(VFIODevice *vdev, QEMUFile *f);
+    uint64_t (*vfio_config_size)(VFIODevice *vdev);
     int (*vfio_load_config)(VFIODevice *vdev, QEMUFile *f);
 };
 
@@ -20,6 +20,7 @@
 #include "sysemu/iothread.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/block-ram-registrar.h"
+#include "qapi/qapi-builtin-types.h"
 #include "qom/object.h"
 
 #define TYPE_VIRTIO_BLK "virtio-blk-device"
@@ -37,6 +38,7 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    strList *iothread_vq_mapping; /* virtqueue i goes to entry i % length */
     char *serial;
     uint32_t request_merging;
     uint16_t num_queues;
@@ -65,6 +67,8 @@ struct VirtIOBlock {
     uint64_t host_features;
     size_t config_size;
     BlockRAMRegistrar blk_ram_registrar;
+    /* Disk size for iothread-vq-mapping, see virtio_blk_sect_range_ok() */
+    uint64_t nb_sectors;
 };
 
 typedef struct VirtIOBlockReq {
@@ -145,6 +145,11 @@ typedef struct VirtioNetRssData {
     uint16_t default_queue;
 } VirtioNetRssData;
 
+typedef struct VirtIONetTxBatch VirtIONetTxBatch;
+
+/* Buckets of the TX burst size histogram, up to bursts of 64 packets */
+#define VIRTIO_NET_TX_BURST_HIST 8
+
 typedef struct VirtIONetQueue {
     VirtQueue *rx_vq;
     VirtQueue *tx_vq;
@@ -154,6 +159,9 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    VirtIONetTxBatch *tx_batch;
+    /* Filled rx elements that wait for the end of a receive burst */
+    unsigned rx_unflushed;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -169,6 +177,13 @@ struct VirtIONet {
     QTAILQ_HEAD(, VirtioNetRscChain) rsc_chains;
     uint32_t tx_timeout;
     int32_t tx_burst;
+    /*
+     * Sizes of the TX bursts handed to the peer, bucket i counts bursts of
+     * 2^(i-1) to 2^i - 1 packets.  Reported by query-stats.
+     */
+    uint64_t tx_burst_hist[VIRTIO_NET_TX_BURST_HIST];
+    /* Nesting depth of receive bursts, see qemu_send_burst_begin() */
+    unsigned rx_burst;
     uint32_t has_vnet_hdr;
     size_t host_hdr_len;
     size_t guest_hdr_len;
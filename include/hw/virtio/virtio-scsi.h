@@ -23,6 +23,7 @@
 #include "hw/scsi/scsi.h"
 #include "chardev/char-fe.h"
 #include "sysemu/iothread.h"
+#include "qapi/qapi-builtin-types.h"
 
 #define TYPE_VIRTIO_SCSI_COMMON "virtio-scsi-common"
 OBJECT_DECLARE_SIMPLE_TYPE(VirtIOSCSICommon, VIRTIO_SCSI_COMMON)
@@ -59,6 +60,7 @@ struct VirtIOSCSIConf {
     CharBackend chardev;
     uint32_t boot_tpgt;
     IOThread *iothread;
+    strList *iothread_vq_mapping;
 };
 
 struct VirtIOSCSI;
@@ -90,8 +92,26 @@ struct VirtIOSCSI {
     QEMUBH *tmf_bh;
     QTAILQ_HEAD(, VirtIOSCSIReq) tmf_bh_list;
 
+    /*
+     * Serialize each virtqueue between the thread that pops its requests and
+     * the threads that complete them.  Only allocated with
+     * iothread-vq-mapping; without it, a virtqueue is only accessed from
+     * one thread.
+     */
+    QemuMutex *vq_locks;
+
     /* Fields for dataplane below */
-    AioContext *ctx; /* one iothread per virtio-scsi-pci for now */
+    AioContext *ctx; /* control and event virtqueues */
+
+    /*
+     * iothread-vq-mapping: command virtqueue i is serviced by entry i modulo
+     * num_vq_iothreads, and LUNs are spread round robin over the same
+     * IOThreads.  Unused otherwise, everything then runs in ctx.
+     */
+    IOThread **vq_iothreads;
+    unsigned num_vq_iothreads;
+    unsigned next_lun_iothread;
+    AioContext **cmd_vq_ctx;
 
     bool dataplane_started;
     bool dataplane_starting;
@@ -123,6 +143,7 @@ void virtio_scsi_common_realize(DeviceState *dev,
 void virtio_scsi_common_unrealize(DeviceState *dev);
 
 void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp);
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s);
 int virtio_scsi_dataplane_start(VirtIODevice *s);
 void virtio_scsi_dataplane_stop(VirtIODevice *s);
 
@@ -66,6 +66,13 @@ typedef struct SaveVMHandlers {
     /* This calculate the exact remaining data to transfer */
     void (*state_pending_exact)(void *opaque, uint64_t *must_precopy,
                                 uint64_t *can_postcopy);
+    /*
+     * Estimated size of the state saved by save_state once the source is
+     * stopped, i.e. not included in state_pending_*.  Without it the time
+     * measured for the last save_state is used.  Like state_pending_*,
+     * this runs outside the iothread lock.
+     */
+    uint64_t (*state_switchover_estimate)(void *opaque);
     LoadStateHandler *load_state;
     int (*load_setup)(QEMUFile *f, void *opaque);
     int (*load_cleanup)(void *opaque);
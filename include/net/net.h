@@ -49,6 +49,9 @@ typedef int (NetLoad)(NetClientState *);
 typedef void (NetStop)(NetClientState *);
 typedef ssize_t (NetReceive)(NetClientState *, const uint8_t *, size_t);
 typedef ssize_t (NetReceiveIOV)(NetClientState *, const struct iovec *, int);
+typedef void (NetReceiveBurst)(NetClientState *);
+typedef struct NetBatchPacket NetBatchPacket;
+typedef int (NetReceiveBatch)(NetClientState *, const NetBatchPacket *, int);
 typedef void (NetCleanup) (NetClientState *);
 typedef void (LinkStatusChanged)(NetClientState *);
 typedef void (NetClientDestructor)(NetClientState *);
@@ -73,6 +76,9 @@ typedef struct NetClientInfo {
     NetReceive *receive;
     NetReceive *receive_raw;
     NetReceiveIOV *receive_iov;
+    NetReceiveBatch *receive_batch;
+    NetReceiveBurst *receive_burst_begin;
+    NetReceiveBurst *receive_burst_end;
     NetCanReceive *can_receive;
     NetStart *start;
     NetLoad *load;
@@ -117,6 +123,12 @@ struct NetClientState {
 
 typedef QTAILQ_HEAD(NetClientStateList, NetClientState) NetClientStateList;
 
+/* One packet of a batch, see qemu_sendv_packet_batch() */
+struct NetBatchPacket {
+    const struct iovec *iov;
+    int iovcnt;
+};
+
 typedef struct NICState {
     NetClientState *ncs;
     NICConf *conf;
@@ -168,6 +180,8 @@ ssize_t qemu_sendv_packet(NetClientState *nc, const struct iovec *iov,
                           int iovcnt);
 ssize_t qemu_sendv_packet_async(NetClientState *nc, const struct iovec *iov,
                                 int iovcnt, NetPacketSent *sent_cb);
+int qemu_sendv_packet_batch(NetClientState *nc, const NetBatchPacket *pkts,
+                            int count);
 ssize_t qemu_send_packet(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_receive_packet(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_receive_packet_iov(NetClientState *nc,
@@ -176,6 +190,8 @@ ssize_t qemu_receive_packet_iov(NetClientState *nc,
 ssize_t qemu_send_packet_raw(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_async(NetClientState *nc, const uint8_t *buf,
                                int size, NetPacketSent *sent_cb);
+void qemu_send_burst_begin(NetClientState *nc);
+void qemu_send_burst_end(NetClientState *nc);
 void qemu_purge_queued_packets(NetClientState *nc);
 void qemu_flush_queued_packets(NetClientState *nc);
 void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge);
@@ -0,0 +1,151 @@
+/*
+ * QEMU live migration to and from a file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "channel.h"
+#include "file.h"
+#include "migration.h"
+#include "io/channel-file.h"
+#include "io/channel-util.h"
+#include "trace.h"
+
+static char *outgoing_filename;
+
+/*
+ * Multifd channels of a file migration open their own descriptor on
+ * the same file.  With mapped-ram every page has a fixed offset, so
+ * the channels never need to agree on a file position.
+ */
+void file_send_channel_create(QIOTaskFunc f, void *data)
+{
+    QIOChannelFile *ioc;
+    QIOTask *task;
+    Error *err = NULL;
+
+    ioc = qio_channel_file_new_path(outgoing_filename, O_WRONLY, 0, &err);
+
+    task = qio_task_new(OBJECT(ioc), f, data, NULL);
+    if (!ioc) {
+        qio_task_set_error(task, err);
+    }
+    qio_task_complete(task);
+}
+
+int file_send_channel_destroy(QIOChannel *ioc)
+{
+    if (ioc) {
+        qio_channel_close(ioc, NULL);
+        object_unref(OBJECT(ioc));
+    }
+    return 0;
+}
+
+void file_cleanup_outgoing_migration(void)
+{
+    g_free(outgoing_filename);
+    outgoing_filename = NULL;
+}
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp)
+{
+    g_autoptr(QIOChannelFile) fioc = NULL;
+    QIOChannel *ioc;
+
+    trace_migration_file_outgoing(filename);
+
+    if (migrate_mapped_ram() && migrate_use_tls()) {
+        error_setg(errp, "TLS is not supported with mapped-ram");
+        return;
+    }
+
+    fioc = qio_channel_file_new_path(filename, O_CREAT | O_WRONLY | O_TRUNC,
+                                     0600, errp);
+    if (!fioc) {
+        return;
+    }
+
+    if (migrate_mapped_ram() &&
+        !qio_channel_has_feature(QIO_CHANNEL(fioc),
+                                 QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_setg(errp, "mapped-ram requires a seekable file");
+        return;
+    }
+
+    g_free(outgoing_filename);
+    outgoing_filename = g_strdup(filename);
+
+    ioc = QIO_CHANNEL(fioc);
+    qio_channel_set_name(ioc, "migration-file-outgoing");
+    migration_channel_connect(s, ioc, NULL, NULL);
+}
+
+static gboolean file_accept_incoming_migration(QIOChannel *ioc,
+                                               GIOCondition condition,
+                                               gpointer opaque)
+{
+    char *filename = opaque;
+    int i, channels = 1;
+
+    migration_channel_process_incoming(ioc);
+    object_unref(OBJECT(ioc));
+
+    if (migrate_use_multifd()) {
+        channels += migrate_multifd_channels();
+    }
+
+    /*
+     * There is nobody on the other side to connect the multifd
+     * channels, so open them here in the order the main channel
+     * expects them.
+     */
+    for (i = 1; i < channels; i++) {
+        QIOChannelFile *fioc;
+        Error *err = NULL;
+
+        fioc = qio_channel_file_new_path(filename, O_RDONLY, 0, &err);
+        if (!fioc) {
+            error_report_err(err);
+            break;
+        }
+        qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-incoming");
+        migration_channel_process_incoming(QIO_CHANNEL(fioc));
+        object_unref(OBJECT(fioc));
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+void file_start_incoming_migration(const char *filename, Error **errp)
+{
+    QIOChannelFile *fioc = NULL;
+    QIOChannel *ioc;
+
+    trace_migration_file_incoming(filename);
+
+    fioc = qio_channel_file_new_path(filename, O_RDONLY, 0, errp);
+    if (!fioc) {
+        return;
+    }
+
+    if (migrate_mapped_ram() &&
+        !qio_channel_has_feature(QIO_CHANNEL(fioc),
+                                 QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_setg(errp, "mapped-ram requires a seekable file");
+        object_unref(OBJECT(fioc));
+        return;
+    }
+
+    ioc = QIO_CHANNEL(fioc);
+    qio_channel_set_name(ioc, "migration-file-incoming");
+    qio_channel_add_watch_full(ioc, G_IO_IN,
+                               file_accept_incoming_migration,
+                               g_strdup(filename), g_free,
+                               g_main_context_get_thread_default());
+}
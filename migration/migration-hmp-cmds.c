@@ -67,6 +67,14 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, "downtime: %" PRIu64 " ms\n",
                            info->downtime);
         }
+        if (info->has_predicted_downtime) {
+            monitor_printf(mon, "predicted downtime: %" PRIu64 " ms\n",
+                           info->predicted_downtime);
+        }
+        if (info->has_device_downtime) {
+            monitor_printf(mon, "device downtime: %" PRIu64 " ms\n",
+                           info->device_downtime);
+        }
         if (info->has_setup_time) {
             monitor_printf(mon, "setup: %" PRIu64 " ms\n",
                            info->setup_time);
@@ -92,6 +100,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->ram->normal_bytes >> 10);
         monitor_printf(mon, "dirty sync count: %" PRIu64 "\n",
                        info->ram->dirty_sync_count);
+        monitor_printf(mon, "dirty sync time: %" PRIu64 " us "
+                       "(max %" PRIu64 " us)\n",
+                       info->ram->dirty_sync_time,
+                       info->ram->dirty_sync_time_max);
         monitor_printf(mon, "page size: %" PRIu64 " kbytes\n",
                        info->ram->page_size >> 10);
         monitor_printf(mon, "multifd bytes: %" PRIu64 " kbytes\n",
@@ -142,8 +154,12 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->xbzrle_cache->bytes >> 10);
         monitor_printf(mon, "xbzrle pages: %" PRIu64 " pages\n",
                        info->xbzrle_cache->pages);
+        monitor_printf(mon, "xbzrle cache hit: %" PRIu64 " pages\n",
+                       info->xbzrle_cache->cache_hit);
         monitor_printf(mon, "xbzrle cache miss: %" PRIu64 " pages\n",
                        info->xbzrle_cache->cache_miss);
+        monitor_printf(mon, "xbzrle cache eviction: %" PRIu64 " pages\n",
+                       info->xbzrle_cache->cache_eviction);
         monitor_printf(mon, "xbzrle cache miss rate: %0.2f\n",
                        info->xbzrle_cache->cache_miss_rate);
         monitor_printf(mon, "xbzrle encoding rate: %0.2f\n",
@@ -204,6 +220,18 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->vfio->transferred >> 10);
     }
 
+    if (info->has_multifd_recv_channels) {
+        MultiFDChannelStatsList *ch;
+
+        for (ch = info->multifd_recv_channels; ch; ch = ch->next) {
+            monitor_printf(mon, "multifd channel %u: %" PRIu64 " packets, "
+                           "%" PRIu64 " kbytes, %0.2f mbps\n",
+                           ch->value->id, ch->value->packets,
+                           ch->value->bytes >> 10,
+                           ch->value->throughput * 8.0 / 1000 / 1000);
+        }
+    }
+
     qapi_free_MigrationInfo(info);
 }
 
@@ -565,6 +593,10 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_multifd_zstd_level = true;
         visit_type_uint8(v, param, &p->multifd_zstd_level, &err);
         break;
+    case MIGRATION_PARAMETER_MULTIFD_LZ4_ACCELERATION:
+        p->has_multifd_lz4_acceleration = true;
+        visit_type_uint8(v, param, &p->multifd_lz4_acceleration, &err);
+        break;
     case MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE:
         p->has_xbzrle_cache_size = true;
         if (!visit_type_size(v, param, &cache_size, &err)) {
@@ -20,10 +20,12 @@
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/kvm.h"
 #include "rdma.h"
 #include "ram.h"
 #include "migration/global_state.h"
@@ -104,6 +106,8 @@
 #define DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL 1
 /* 0: means nocompress, 1: best speed, ... 20: best compress ratio */
 #define DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL 1
+/* 1: default lz4 speed, bigger values trade ratio for speed */
+#define DEFAULT_MIGRATE_MULTIFD_LZ4_ACCELERATION 1
 
 /* Background transfer rate for postcopy, 0 means unlimited, note
  * that page requests can still exceed this limit.
@@ -167,7 +171,12 @@ INITIALIZE_MIGRATE_CAPS_SET(check_caps_background_snapshot,
     MIGRATION_CAPABILITY_XBZRLE,
     MIGRATION_CAPABILITY_X_COLO,
     MIGRATION_CAPABILITY_VALIDATE_UUID,
-    MIGRATION_CAPABILITY_ZERO_COPY_SEND);
+    MIGRATION_CAPABILITY_ZERO_COPY_SEND,
+    MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE,
+    MIGRATION_CAPABILITY_MAPPED_RAM,
+    MIGRATION_CAPABILITY_POSTCOPY_MULTIFD,
+    MIGRATION_CAPABILITY_ASYNC_DEVICE_STATE,
+    MIGRATION_CAPABILITY_DIRTY_LIMIT);
 
 /* When we add fault tolerance, we could have several
    migrations at once.  For now we don't need to add
@@ -192,7 +201,8 @@ static bool migration_needs_multiple_sockets(void)
 static bool uri_supports_multi_channels(const char *uri)
 {
     return strstart(uri, "tcp:", NULL) || strstart(uri, "unix:", NULL) ||
-           strstart(uri, "vsock:", NULL);
+           strstart(uri, "vsock:", NULL) ||
+           (migrate_mapped_ram() && strstart(uri, "file:", NULL));
 }
 
 static bool
@@ -204,6 +214,11 @@ migration_channels_and_uri_compatible(const char *uri, Error **errp)
         return false;
     }
 
+    if (migrate_mapped_ram() && !strstart(uri, "file:", NULL)) {
+        error_setg(errp, "mapped-ram requires a file: URI");
+        return false;
+    }
+
     return true;
 }
 
@@ -232,6 +247,7 @@ void migration_object_init(void)
     qemu_mutex_init(&current_incoming->rp_mutex);
     qemu_mutex_init(&current_incoming->postcopy_prio_thread_mutex);
     qemu_event_init(&current_incoming->main_thread_load_event, false);
+    qemu_event_init(&current_incoming->postcopy_listen_event, false);
     qemu_sem_init(&current_incoming->postcopy_pause_sem_dst, 0);
     qemu_sem_init(&current_incoming->postcopy_pause_sem_fault, 0);
     qemu_sem_init(&current_incoming->postcopy_pause_sem_fast_load, 0);
@@ -336,6 +352,7 @@ void migration_incoming_state_destroy(void)
 
     migration_incoming_transport_cleanup(mis);
     qemu_event_reset(&mis->main_thread_load_event);
+    qemu_event_reset(&mis->postcopy_listen_event);
 
     if (mis->page_requested) {
         g_tree_destroy(mis->page_requested);
@@ -526,6 +543,8 @@ static void qemu_start_incoming_migration(const char *uri, Error **errp)
         exec_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -994,6 +1013,8 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->multifd_zlib_level = s->parameters.multifd_zlib_level;
     params->has_multifd_zstd_level = true;
     params->multifd_zstd_level = s->parameters.multifd_zstd_level;
+    params->has_multifd_lz4_acceleration = true;
+    params->multifd_lz4_acceleration = s->parameters.multifd_lz4_acceleration;
     params->has_xbzrle_cache_size = true;
     params->xbzrle_cache_size = s->parameters.xbzrle_cache_size;
     params->has_max_postcopy_bandwidth = true;
@@ -1133,6 +1154,13 @@ static void populate_time_info(MigrationInfo *info, MigrationState *s)
         info->has_expected_downtime = true;
         info->expected_downtime = s->expected_downtime;
     }
+
+    if (s->bandwidth) {
+        info->has_predicted_downtime = true;
+        info->predicted_downtime = s->predicted_downtime;
+        info->has_device_downtime = true;
+        info->device_downtime = s->switchover_time;
+    }
 }
 
 static void populate_ram_info(MigrationInfo *info, MigrationState *s)
@@ -1151,6 +1179,8 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->dirty_sync_count = ram_counters.dirty_sync_count;
     info->ram->dirty_sync_missed_zero_copy =
             ram_counters.dirty_sync_missed_zero_copy;
+    info->ram->dirty_sync_time = ram_counters.dirty_sync_time;
+    info->ram->dirty_sync_time_max = ram_counters.dirty_sync_time_max;
     info->ram->postcopy_requests = ram_counters.postcopy_requests;
     info->ram->page_size = page_size;
     info->ram->multifd_bytes = ram_counters.multifd_bytes;
@@ -1168,6 +1198,8 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         info->xbzrle_cache->cache_miss_rate = xbzrle_counters.cache_miss_rate;
         info->xbzrle_cache->encoding_rate = xbzrle_counters.encoding_rate;
         info->xbzrle_cache->overflow = xbzrle_counters.overflow;
+        info->xbzrle_cache->cache_hit = xbzrle_counters.cache_hit;
+        info->xbzrle_cache->cache_eviction = xbzrle_counters.cache_eviction;
     }
 
     if (migrate_use_compression()) {
@@ -1255,6 +1287,10 @@ static void fill_source_migration_info(MigrationInfo *info)
         populate_time_info(info, s);
         populate_ram_info(info, s);
         populate_vfio_info(info);
+        if (migrate_async_device_state()) {
+            info->has_device_state_overlap = true;
+            info->device_state_overlap = s->device_state_overlap;
+        }
         break;
     case MIGRATION_STATUS_FAILED:
         info->has_status = true;
@@ -1435,6 +1471,96 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE] &&
+        !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+        error_setg(errp, "Multifd zero page requires multifd");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_MULTIFD]) {
+        if (!cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Postcopy multifd requires postcopy-ram and "
+                       "multifd");
+            return false;
+        }
+
+        /*
+         * Pages are placed straight from the bytes read off the
+         * channel; the compression methods decompress into guest
+         * memory, which is not possible once it is registered with
+         * userfaultfd.
+         */
+        if (migrate_multifd_compression()) {
+            error_setg(errp, "Postcopy multifd is not compatible with "
+                       "multifd compression");
+            return false;
+        }
+
+        /*
+         * Preempt channels carry no magic, so they can't be told apart
+         * from multifd channels on the destination.  Faulted pages
+         * don't queue behind background pages anyway, as those go
+         * through multifd.
+         */
+        if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
+            error_setg(errp, "Postcopy multifd is not compatible with "
+                       "postcopy-preempt");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_DIRTY_LIMIT]) {
+        if (cap_list[MIGRATION_CAPABILITY_AUTO_CONVERGE]) {
+            error_setg(errp, "dirty-limit conflicts with auto-converge, "
+                       "only one of them can throttle the guest");
+            return false;
+        }
+
+        if (!kvm_enabled() || !kvm_dirty_ring_enabled()) {
+            error_setg(errp, "dirty-limit requires KVM with accelerator "
+                       "property 'dirty-ring-size' set");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_ASYNC_DEVICE_STATE]) {
+        /*
+         * Without multifd the RAM pages go on the main channel, which
+         * can't take the device state at the same time.
+         */
+        if (!cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Async device state requires multifd");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        if (cap_list[MIGRATION_CAPABILITY_XBZRLE] ||
+            cap_list[MIGRATION_CAPABILITY_COMPRESS] ||
+            migrate_multifd_compression()) {
+            error_setg(errp, "mapped-ram is not compatible with compression");
+            return false;
+        }
+
+        if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp, "mapped-ram is not compatible with postcopy");
+            return false;
+        }
+
+        if (cap_list[MIGRATION_CAPABILITY_X_IGNORE_SHARED]) {
+            error_setg(errp, "mapped-ram is not compatible with "
+                       "ignore-shared");
+            return false;
+        }
+
+        if (cap_list[MIGRATION_CAPABILITY_ZERO_COPY_SEND]) {
+            error_setg(errp, "mapped-ram is not compatible with "
+                       "zero-copy-send");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -1468,6 +1594,9 @@ static void fill_destination_migration_info(MigrationInfo *info)
         break;
     }
     info->status = mis->state;
+
+    info->multifd_recv_channels = multifd_recv_channel_stats();
+    info->has_multifd_recv_channels = !!info->multifd_recv_channels;
 }
 
 MigrationInfo *qmp_query_migrate(Error **errp)
@@ -1596,6 +1725,14 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_multifd_lz4_acceleration &&
+        (params->multifd_lz4_acceleration < 1)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "multifd_lz4_acceleration",
+                   "a value between 1 and 255");
+        return false;
+    }
+
     if (params->has_xbzrle_cache_size &&
         (params->xbzrle_cache_size < qemu_target_page_size() ||
          !is_power_of_2(params->xbzrle_cache_size))) {
@@ -1660,6 +1797,13 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
     }
 #endif
 
+    if (migrate_postcopy_multifd() &&
+        params->has_multifd_compression && params->multifd_compression) {
+        error_setg(errp, "Postcopy multifd is not compatible with "
+                   "multifd compression");
+        return false;
+    }
+
     return true;
 }
 
@@ -1733,6 +1877,9 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_multifd_compression) {
         dest->multifd_compression = params->multifd_compression;
     }
+    if (params->has_multifd_lz4_acceleration) {
+        dest->multifd_lz4_acceleration = params->multifd_lz4_acceleration;
+    }
     if (params->has_xbzrle_cache_size) {
         dest->xbzrle_cache_size = params->xbzrle_cache_size;
     }
@@ -1845,6 +1992,10 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_multifd_compression) {
         s->parameters.multifd_compression = params->multifd_compression;
     }
+    if (params->has_multifd_lz4_acceleration) {
+        s->parameters.multifd_lz4_acceleration =
+            params->multifd_lz4_acceleration;
+    }
     if (params->has_xbzrle_cache_size) {
         s->parameters.xbzrle_cache_size = params->xbzrle_cache_size;
         xbzrle_cache_resize(params->xbzrle_cache_size, errp);
@@ -2017,6 +2168,7 @@ static void migrate_fd_cleanup(MigrationState *s)
         migration_ioc_unregister_yank_from_file(tmp);
         qemu_fclose(tmp);
     }
+    file_cleanup_outgoing_migration();
 
     if (s->postcopy_qemufile_src) {
         migration_ioc_unregister_yank_from_file(s->postcopy_qemufile_src);
@@ -2250,6 +2402,10 @@ void migrate_init(MigrationState *s)
     s->pages_per_second = 0.0;
     s->downtime = 0;
     s->expected_downtime = 0;
+    s->bandwidth = 0.0;
+    s->switchover_time = 0;
+    s->predicted_downtime = 0;
+    s->device_state_overlap = 0;
     s->setup_time = 0;
     s->start_postcopy = false;
     s->postcopy_after_devices = false;
@@ -2523,6 +2679,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         exec_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         if (!(has_resume && resume)) {
             yank_unregister_instance(MIGRATION_YANK_INSTANCE);
@@ -2711,6 +2869,51 @@ bool migrate_pause_before_switchover(void)
         MIGRATION_CAPABILITY_PAUSE_BEFORE_SWITCHOVER];
 }
 
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
+bool migrate_postcopy_multifd(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_MULTIFD];
+}
+
+bool migrate_dirty_limit(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_LIMIT];
+}
+
+bool migrate_async_device_state(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_ASYNC_DEVICE_STATE];
+}
+
+bool migrate_multifd_zero_page(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE];
+}
+
 int migrate_multifd_channels(void)
 {
     MigrationState *s;
@@ -2748,6 +2951,15 @@ int migrate_multifd_zstd_level(void)
     return s->parameters.multifd_zstd_level;
 }
 
+int migrate_multifd_lz4_acceleration(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.multifd_lz4_acceleration;
+}
+
 #ifdef CONFIG_LINUX
 bool migrate_use_zero_copy_send(void)
 {
@@ -3791,6 +4003,7 @@ static void migration_calculate_complete(MigrationState *s)
          */
         s->downtime = end_time - s->downtime_start;
     }
+    trace_migration_downtime(s->predicted_downtime, s->downtime);
 
     transfer_time = s->total_time - s->setup_time;
     if (transfer_time) {
@@ -3814,6 +4027,8 @@ static void migration_update_counters(MigrationState *s,
 {
     uint64_t transferred, transferred_pages, time_spent;
     uint64_t current_bytes; /* bytes transferred since the beginning */
+    uint64_t switchover_size;
+    int64_t switchover_time_us;
     double bandwidth;
 
     if (current_time < s->iteration_start_time + BUFFER_DELAY) {
@@ -3824,7 +4039,24 @@ static void migration_update_counters(MigrationState *s,
     transferred = current_bytes - s->iteration_initial_bytes;
     time_spent = current_time - s->iteration_start_time;
     bandwidth = (double)transferred / time_spent;
-    s->threshold_size = bandwidth * s->parameters.downtime_limit;
+
+    /*
+     * Device state is saved with the VM stopped too: leave out of the
+     * RAM budget the time it took last time, and the time to send what
+     * the handlers expect to send now.
+     */
+    qemu_savevm_state_switchover_estimate(&switchover_size,
+                                          &switchover_time_us);
+    s->switchover_time = DIV_ROUND_UP(switchover_time_us, 1000);
+    if (bandwidth) {
+        s->switchover_time += switchover_size / bandwidth;
+    }
+    trace_migrate_switchover_estimate(switchover_size, switchover_time_us,
+                                      s->switchover_time);
+
+    s->bandwidth = bandwidth;
+    s->threshold_size = bandwidth * MAX((int64_t)s->parameters.downtime_limit -
+                                        s->switchover_time, 0);
 
     s->mbps = (((double) transferred * 8.0) /
                ((double) time_spent / 1000.0)) / 1000.0 / 1000.0;
@@ -3877,6 +4109,11 @@ static MigIterateState migration_iteration_run(MigrationState *s)
         trace_migrate_pending_exact(pending_size, must_precopy, can_postcopy);
     }
 
+    if (!in_postcopy && s->bandwidth) {
+        s->predicted_downtime = pending_size / s->bandwidth +
+                                s->switchover_time;
+    }
+
     if (!pending_size || pending_size < s->threshold_size) {
         trace_migration_thread_low_pending(pending_size);
         migration_completion(s);
@@ -3903,6 +4140,8 @@ static void migration_iteration_finish(MigrationState *s)
     cpu_throttle_stop();
 
     qemu_mutex_lock_iothread();
+    /* Same for the vCPU dirty limit of dirty-limit */
+    ram_dirty_limit_stop();
     switch (s->state) {
     case MIGRATION_STATUS_COMPLETED:
         migration_calculate_complete(s);
@@ -4427,6 +4666,8 @@ void migration_global_dump(Monitor *mon)
                    ms->decompress_error_check ? "on" : "off");
     monitor_printf(mon, "clear-bitmap-shift: %u\n",
                    ms->clear_bitmap_shift);
+    monitor_printf(mon, "bitmap-sync-threads: %u\n",
+                   ms->bitmap_sync_threads);
 }
 
 #define DEFINE_PROP_MIG_CAP(name, x)             \
@@ -4443,6 +4684,8 @@ static Property migration_properties[] = {
                       decompress_error_check, true),
     DEFINE_PROP_UINT8("x-clear-bitmap-shift", MigrationState,
                       clear_bitmap_shift, CLEAR_BITMAP_SHIFT_DEFAULT),
+    DEFINE_PROP_UINT8("x-bitmap-sync-threads", MigrationState,
+                      bitmap_sync_threads, BITMAP_SYNC_THREADS_DEFAULT),
 
     /* Migration parameters */
     DEFINE_PROP_UINT8("x-compress-level", MigrationState,
@@ -4487,6 +4730,9 @@ static Property migration_properties[] = {
     DEFINE_PROP_UINT8("multifd-zstd-level", MigrationState,
                       parameters.multifd_zstd_level,
                       DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL),
+    DEFINE_PROP_UINT8("multifd-lz4-acceleration", MigrationState,
+                      parameters.multifd_lz4_acceleration,
+                      DEFAULT_MIGRATE_MULTIFD_LZ4_ACCELERATION),
     DEFINE_PROP_SIZE("xbzrle-cache-size", MigrationState,
                       parameters.xbzrle_cache_size,
                       DEFAULT_MIGRATE_XBZRLE_CACHE_SIZE),
@@ -4527,6 +4773,14 @@ static Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-block", MIGRATION_CAPABILITY_BLOCK),
     DEFINE_PROP_MIG_CAP("x-return-path", MIGRATION_CAPABILITY_RETURN_PATH),
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_MULTIFD),
+    DEFINE_PROP_MIG_CAP("x-multifd-zero-page",
+                        MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("x-postcopy-multifd",
+                        MIGRATION_CAPABILITY_POSTCOPY_MULTIFD),
+    DEFINE_PROP_MIG_CAP("x-async-device-state",
+                        MIGRATION_CAPABILITY_ASYNC_DEVICE_STATE),
+    DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
     DEFINE_PROP_MIG_CAP("x-background-snapshot",
             MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT),
 #ifdef CONFIG_LINUX
@@ -4593,6 +4847,7 @@ static void migration_instance_init(Object *obj)
     params->has_multifd_compression = true;
     params->has_multifd_zlib_level = true;
     params->has_multifd_zstd_level = true;
+    params->has_multifd_lz4_acceleration = true;
     params->has_xbzrle_cache_size = true;
     params->has_max_postcopy_bandwidth = true;
     params->has_max_cpu_throttle = true;
@@ -41,6 +41,8 @@ struct PostcopyBlocktimeContext;
  * default value to use if no one specified.
  */
 #define CLEAR_BITMAP_SHIFT_DEFAULT        18
+
+#define BITMAP_SYNC_THREADS_DEFAULT       4
 /*
  * 1<<31=2G pages -> 8T chunk when page size is 4K.  This should be
  * big enough and make sure we won't overflow easily.
@@ -83,6 +85,11 @@ struct MigrationIncomingState {
      * loading state.
      */
     QemuEvent main_thread_load_event;
+    /*
+     * Set once the destination listens for postcopy pages, i.e. when
+     * userfaultfd is registered, so that multifd channels can place them.
+     */
+    QemuEvent postcopy_listen_event;
 
     /* For network announces */
     AnnounceTimer  announce_timer;
@@ -299,6 +306,23 @@ struct MigrationState {
     int64_t downtime_start;
     int64_t downtime;
     int64_t expected_downtime;
+    /* Bandwidth measured over the last iteration, in bytes per ms */
+    double bandwidth;
+    /*
+     * Time the non-iterable device state is expected to take at
+     * switchover (ms); it is taken out of the downtime-limit budget
+     */
+    int64_t switchover_time;
+    /*
+     * Downtime expected if the switchover happened with what is pending
+     * now; frozen at switchover so it can be compared with @downtime
+     */
+    int64_t predicted_downtime;
+    /*
+     * Bytes of device state that async-device-state saved while the last
+     * RAM pages were still being sent
+     */
+    uint64_t device_state_overlap;
     bool enabled_capabilities[MIGRATION_CAPABILITY__MAX];
     int64_t setup_time;
     /*
@@ -375,6 +399,13 @@ struct MigrationState {
      */
     uint8_t clear_bitmap_shift;
 
+    /*
+     * Number of threads, including the migration thread, merging the
+     * dirty log into the migration bitmap on each sync.  1 means the
+     * migration thread does it alone.
+     */
+    uint8_t bitmap_sync_threads;
+
     /*
      * This save hostname when out-going migration starts
      */
@@ -420,10 +451,16 @@ bool migrate_validate_uuid(void);
 bool migrate_auto_converge(void);
 bool migrate_use_multifd(void);
 bool migrate_pause_before_switchover(void);
+bool migrate_multifd_zero_page(void);
+bool migrate_mapped_ram(void);
+bool migrate_postcopy_multifd(void);
+bool migrate_async_device_state(void);
+bool migrate_dirty_limit(void);
 int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
 int migrate_multifd_zlib_level(void);
 int migrate_multifd_zstd_level(void);
+int migrate_multifd_lz4_acceleration(void);
 
 #ifdef CONFIG_LINUX
 bool migrate_use_zero_copy_send(void);
@@ -0,0 +1,289 @@
+/*
+ * Multifd lz4 compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <lz4.h>
+#include "qemu/bswap.h"
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * Each page is compressed as an independent lz4 block, so the
+ * receiving side can decompress straight into guest memory without a
+ * bounce buffer.  On the wire every page is preceded by a big endian
+ * 32 bit length.  A length equal to the page size means that lz4 was
+ * not able to shrink the page and it is sent as is.
+ */
+#define LZ4_HDR_SIZE sizeof(uint32_t)
+
+struct lz4_data {
+    /* lz4 compression state, only used on the send side */
+    void *state;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+    /* lz4 acceleration factor, bigger means faster and worse ratio */
+    int acceleration;
+    /* bytes of guest memory handled by this channel */
+    uint64_t raw_bytes;
+    /* bytes put on (or taken from) the wire by this channel */
+    uint64_t wire_bytes;
+    /* pages that were sent uncompressed */
+    uint64_t raw_pages;
+};
+
+/* Multifd lz4 compression */
+
+/**
+ * lz4_send_setup: setup send side
+ *
+ * Setup each channel with lz4 compression.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->state = g_try_malloc(LZ4_sizeofState());
+    if (!z->state) {
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for lz4 state", p->id);
+        return -1;
+    }
+    /* Worst case every page goes uncompressed after its header */
+    z->zbuff_len = p->page_count * (LZ4_HDR_SIZE + p->page_size);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        g_free(z->state);
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    z->acceleration = migrate_multifd_lz4_acceleration();
+    p->data = z;
+    return 0;
+}
+
+/**
+ * lz4_send_cleanup: cleanup send side
+ *
+ * Report the channel statistics and return memory.
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void lz4_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = p->data;
+
+    trace_multifd_lz4_send_stats(p->id, z->raw_bytes, z->wire_bytes,
+                                 z->raw_pages);
+    g_free(z->state);
+    z->state = NULL;
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_send_prepare: prepare date to be able to send
+ *
+ * Create a compressed buffer with all the pages that we are going to
+ * send.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = p->data;
+    uint32_t pos = 0;
+    uint32_t i;
+
+    for (i = 0; i < p->normal_num; i++) {
+        const char *src = (const char *)p->pages->block->host + p->normal[i];
+        char *dst = (char *)z->zbuff + pos + LZ4_HDR_SIZE;
+        int ret;
+
+        /*
+         * Anything that does not end up smaller than the page is
+         * cheaper to send raw, so cap the output one byte short.
+         */
+        ret = LZ4_compress_fast_extState(z->state, src, dst, p->page_size,
+                                         p->page_size - 1, z->acceleration);
+        if (ret < 0) {
+            error_setg(errp, "multifd %u: lz4 compression failed", p->id);
+            return -1;
+        }
+        if (ret == 0) {
+            memcpy(dst, src, p->page_size);
+            ret = p->page_size;
+            z->raw_pages++;
+        }
+        stl_be_p(z->zbuff + pos, ret);
+        pos += LZ4_HDR_SIZE + ret;
+    }
+    z->raw_bytes += (uint64_t)p->normal_num * p->page_size;
+    z->wire_bytes += pos;
+
+    p->iov[p->iovs_num].iov_base = z->zbuff;
+    p->iov[p->iovs_num].iov_len = pos;
+    p->iovs_num++;
+    p->next_packet_size = pos;
+    p->flags |= MULTIFD_FLAG_LZ4;
+
+    return 0;
+}
+
+/**
+ * lz4_recv_setup: setup receive side
+ *
+ * Create the compressed buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->zbuff_len = p->page_count * (LZ4_HDR_SIZE + p->page_size);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+/**
+ * lz4_recv_cleanup: cleanup receive side
+ *
+ * Report the channel statistics and return memory.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct lz4_data *z = p->data;
+
+    trace_multifd_lz4_recv_stats(p->id, z->raw_bytes, z->wire_bytes,
+                                 z->raw_pages);
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the compressed buffer, and uncompress it into the actual
+ * pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_pages(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    struct lz4_data *z = p->data;
+    uint32_t pos = 0;
+    uint32_t i;
+    int ret;
+
+    if (flags != MULTIFD_FLAG_LZ4) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_LZ4);
+        return -1;
+    }
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %u: packet size received %u max size %u",
+                   p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        char *dst = (char *)p->host + p->normal[i];
+        uint32_t len;
+
+        if (in_size - pos < LZ4_HDR_SIZE) {
+            error_setg(errp, "multifd %u: truncated lz4 packet", p->id);
+            return -1;
+        }
+        len = ldl_be_p(z->zbuff + pos);
+        pos += LZ4_HDR_SIZE;
+        if (len > p->page_size || len > in_size - pos) {
+            error_setg(errp, "multifd %u: invalid lz4 block size %u",
+                       p->id, len);
+            return -1;
+        }
+        if (len == p->page_size) {
+            memcpy(dst, z->zbuff + pos, len);
+            z->raw_pages++;
+        } else {
+            ret = LZ4_decompress_safe((const char *)z->zbuff + pos, dst,
+                                      len, p->page_size);
+            if (ret != p->page_size) {
+                error_setg(errp, "multifd %u: lz4 decompression failed "
+                           "(returned %d, expected %u)", p->id, ret,
+                           p->page_size);
+                return -1;
+            }
+        }
+        pos += len;
+    }
+    if (pos != in_size) {
+        error_setg(errp, "multifd %u: packet size received %u size used %u",
+                   p->id, in_size, pos);
+        return -1;
+    }
+    z->raw_bytes += (uint64_t)p->normal_num * p->page_size;
+    z->wire_bytes += in_size;
+    return 0;
+}
+
+static MultiFDMethods multifd_lz4_ops = {
+    .send_setup = lz4_send_setup,
+    .send_cleanup = lz4_send_cleanup,
+    .send_prepare = lz4_send_prepare,
+    .recv_setup = lz4_recv_setup,
+    .recv_cleanup = lz4_recv_cleanup,
+    .recv_pages = lz4_recv_pages
+};
+
+static void multifd_lz4_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_LZ4, &multifd_lz4_ops);
+}
+
+migration_init(multifd_lz4_register);
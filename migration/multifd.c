@@ -12,6 +12,8 @@
 
 #include "qemu/osdep.h"
 #include "qemu/rcu.h"
+#include "qemu/cutils.h"
+#include "qemu/timer.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
@@ -20,8 +22,10 @@
 #include "ram.h"
 #include "migration.h"
 #include "socket.h"
+#include "file.h"
 #include "tls.h"
 #include "qemu-file.h"
+#include "postcopy-ram.h"
 #include "trace.h"
 #include "multifd.h"
 #include "threadinfo.h"
@@ -139,17 +143,28 @@ static void nocomp_recv_cleanup(MultiFDRecvParams *p)
 static int nocomp_recv_pages(MultiFDRecvParams *p, Error **errp)
 {
     uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    int iovcnt = 0;
 
     if (flags != MULTIFD_FLAG_NOCOMP) {
         error_setg(errp, "multifd %u: flags received %x flags expected %x",
                    p->id, flags, MULTIFD_FLAG_NOCOMP);
         return -1;
     }
+
     for (int i = 0; i < p->normal_num; i++) {
-        p->iov[i].iov_base = p->host + p->normal[i];
-        p->iov[i].iov_len = p->page_size;
+        uint8_t *host = p->host + p->normal[i];
+        struct iovec *last = iovcnt ? &p->iov[iovcnt - 1] : NULL;
+
+        /* Pages are mostly sent in order, read runs of them in one go */
+        if (last && (uint8_t *)last->iov_base + last->iov_len == host) {
+            last->iov_len += p->page_size;
+            continue;
+        }
+        p->iov[iovcnt].iov_base = host;
+        p->iov[iovcnt].iov_len = p->page_size;
+        iovcnt++;
     }
-    return qio_channel_readv_all(p->c, p->iov, p->normal_num, errp);
+    return qio_channel_readv_all(p->c, p->iov, iovcnt, errp);
 }
 
 static MultiFDMethods multifd_nocomp_ops = {
@@ -262,6 +277,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(p->pages->allocated);
     packet->normal_pages = cpu_to_be32(p->normal_num);
+    packet->zero_pages = cpu_to_be32(p->zero_num);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
 
@@ -275,6 +291,13 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
 
         packet->offset[i] = cpu_to_be64(temp);
     }
+
+    for (i = 0; i < p->zero_num; i++) {
+        /* there are architectures where ram_addr_t is 32 bit */
+        uint64_t temp = p->zero[i];
+
+        packet->offset[p->normal_num + i] = cpu_to_be64(temp);
+    }
 }
 
 static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
@@ -321,10 +344,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->zero_num = be32_to_cpu(packet->zero_pages);
+    if (p->zero_num > packet->pages_alloc - p->normal_num) {
+        error_setg(errp, "multifd: received packet "
+                   "with %u zero pages and expected maximum pages are %u",
+                   p->zero_num, packet->pages_alloc - p->normal_num) ;
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->normal_num == 0) {
+    if (p->normal_num == 0 && p->zero_num == 0) {
         return 0;
     }
 
@@ -338,6 +369,7 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     }
 
     p->host = block->host;
+    p->block = block;
     for (i = 0; i < p->normal_num; i++) {
         uint64_t offset = be64_to_cpu(packet->offset[i]);
 
@@ -350,6 +382,71 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->normal[i] = offset;
     }
 
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t offset = be64_to_cpu(packet->offset[p->normal_num + i]);
+
+        if (offset > (block->used_length - p->page_size)) {
+            error_setg(errp, "multifd: offset too long %" PRIu64
+                       " (max " RAM_ADDR_FMT ")",
+                       offset, block->used_length);
+            return -1;
+        }
+        p->zero[i] = offset;
+    }
+
+    return 0;
+}
+
+/**
+ * multifd_send_detects_zero_pages: whether the send channels check for
+ * zero pages
+ *
+ * mapped-ram always needs it, as zero pages are recorded in the file
+ * bitmap rather than in the migration stream.
+ */
+bool multifd_send_detects_zero_pages(void)
+{
+    return migrate_multifd_zero_page() || migrate_mapped_ram();
+}
+
+/**
+ * multifd_file_write_pages: write the pages of a job to the file
+ *
+ * With mapped-ram each page has a fixed place in the file, so normal
+ * pages are written there directly, coalescing contiguous ones, and
+ * zero pages are only dropped from the file bitmap.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @block: RAMBlock the pages belong to
+ * @errp: pointer to an error
+ */
+static int multifd_file_write_pages(MultiFDSendParams *p, RAMBlock *block,
+                                    Error **errp)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < p->normal_num; i = j) {
+        ram_addr_t start = p->normal[i];
+
+        for (j = i + 1; j < p->normal_num &&
+             p->normal[j] == p->normal[j - 1] + p->page_size; j++) {
+            /* nothing */
+        }
+
+        if (qio_channel_pwrite_all(p->c, (char *)block->host + start,
+                                   (j - i) * p->page_size,
+                                   block->pages_offset + start, errp) < 0) {
+            return -1;
+        }
+        bitmap_set_atomic(block->file_bmap, start / p->page_size, j - i);
+    }
+
+    for (i = 0; i < p->zero_num; i++) {
+        clear_bit_atomic(p->zero[i] / p->page_size, block->file_bmap);
+    }
+
     return 0;
 }
 
@@ -428,6 +525,9 @@ static int multifd_send_pages(QEMUFile *f)
     assert(!p->pages->block);
 
     p->packet_num = multifd_send_state->packet_num++;
+    if (migrate_postcopy_multifd() && migration_in_postcopy()) {
+        p->flags |= MULTIFD_FLAG_POSTCOPY;
+    }
     multifd_send_state->pages = p->pages;
     p->pages = pages;
     transferred = ((uint64_t) pages->num) * p->page_size + p->packet_len;
@@ -534,7 +634,11 @@ void multifd_save_cleanup(void)
         if (p->registered_yank) {
             migration_ioc_unregister_yank(p->c);
         }
-        socket_send_channel_destroy(p->c);
+        if (migrate_mapped_ram()) {
+            file_send_channel_destroy(p->c);
+        } else {
+            socket_send_channel_destroy(p->c);
+        }
         p->c = NULL;
         qemu_mutex_destroy(&p->mutex);
         qemu_sem_destroy(&p->sem);
@@ -550,6 +654,8 @@ void multifd_save_cleanup(void)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         multifd_send_state->ops->send_cleanup(p, &local_err);
         if (local_err) {
             migrate_set_error(migrate_get_current(), local_err);
@@ -654,13 +760,16 @@ static void *multifd_send_thread(void *opaque)
     Error *local_err = NULL;
     int ret = 0;
     bool use_zero_copy_send = migrate_use_zero_copy_send();
+    bool use_zero_page = multifd_send_detects_zero_pages();
+    bool use_mapped_ram = migrate_mapped_ram();
 
     thread = MigrationThreadAdd(p->name, qemu_get_thread_id());
 
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
-    if (multifd_send_initial_packet(p, &local_err) < 0) {
+    /* mapped-ram writes pages to their offset, there is no packet stream */
+    if (!use_mapped_ram && multifd_send_initial_packet(p, &local_err) < 0) {
         ret = -1;
         goto out;
     }
@@ -678,7 +787,9 @@ static void *multifd_send_thread(void *opaque)
         if (p->pending_job) {
             uint64_t packet_num = p->packet_num;
             uint32_t flags = p->flags;
+            RAMBlock *rb = p->pages->block;
             p->normal_num = 0;
+            p->zero_num = 0;
 
             if (use_zero_copy_send) {
                 p->iovs_num = 0;
@@ -687,11 +798,20 @@ static void *multifd_send_thread(void *opaque)
             }
 
             for (int i = 0; i < p->pages->num; i++) {
-                p->normal[p->normal_num] = p->pages->offset[i];
-                p->normal_num++;
+                ram_addr_t offset = p->pages->offset[i];
+
+                if (use_zero_page &&
+                    buffer_is_zero(rb->host + offset, p->page_size)) {
+                    p->zero[p->zero_num] = offset;
+                    p->zero_num++;
+                    ram_release_page(rb->idstr, offset);
+                } else {
+                    p->normal[p->normal_num] = offset;
+                    p->normal_num++;
+                }
             }
 
-            if (p->normal_num) {
+            if (p->normal_num && !use_mapped_ram) {
                 ret = multifd_send_state->ops->send_prepare(p, &local_err);
                 if (ret != 0) {
                     qemu_mutex_unlock(&p->mutex);
@@ -702,30 +822,44 @@ static void *multifd_send_thread(void *opaque)
             p->flags = 0;
             p->num_packets++;
             p->total_normal_pages += p->normal_num;
+            p->total_zero_pages += p->zero_num;
             p->pages->num = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
-            trace_multifd_send(p->id, packet_num, p->normal_num, flags,
-                               p->next_packet_size);
+            if (use_zero_page) {
+                stat64_add(&ram_atomic_counters.normal, p->normal_num);
+                stat64_add(&ram_atomic_counters.duplicate, p->zero_num);
+            }
+
+            trace_multifd_send(p->id, packet_num, p->normal_num, p->zero_num,
+                               flags, p->next_packet_size);
 
-            if (use_zero_copy_send) {
-                /* Send header first, without zerocopy */
-                ret = qio_channel_write_all(p->c, (void *)p->packet,
-                                            p->packet_len, &local_err);
+            if (use_mapped_ram) {
+                ret = multifd_file_write_pages(p, rb, &local_err);
                 if (ret != 0) {
                     break;
                 }
             } else {
-                /* Send header using the same writev call */
-                p->iov[0].iov_len = p->packet_len;
-                p->iov[0].iov_base = p->packet;
-            }
+                if (use_zero_copy_send) {
+                    /* Send header first, without zerocopy */
+                    ret = qio_channel_write_all(p->c, (void *)p->packet,
+                                                p->packet_len, &local_err);
+                    if (ret != 0) {
+                        break;
+                    }
+                } else {
+                    /* Send header using the same writev call */
+                    p->iov[0].iov_len = p->packet_len;
+                    p->iov[0].iov_base = p->packet;
+                }
 
-            ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num, NULL,
-                                              0, p->write_flags, &local_err);
-            if (ret != 0) {
-                break;
+                ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num,
+                                                  NULL, 0, p->write_flags,
+                                                  &local_err);
+                if (ret != 0) {
+                    break;
+                }
             }
 
             qemu_mutex_lock(&p->mutex);
@@ -767,7 +901,8 @@ out:
 
     rcu_unregister_thread();
     MigrationThreadDel(thread);
-    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -941,6 +1076,7 @@ int multifd_save_setup(Error **errp)
         /* We need one extra place for the packet header */
         p->iov = g_new0(struct iovec, page_count + 1);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
         p->page_size = qemu_target_page_size();
         p->page_count = page_count;
 
@@ -950,7 +1086,11 @@ int multifd_save_setup(Error **errp)
             p->write_flags = 0;
         }
 
-        socket_send_channel_create(multifd_new_send_channel_async, p);
+        if (migrate_mapped_ram()) {
+            file_send_channel_create(multifd_new_send_channel_async, p);
+        } else {
+            socket_send_channel_create(multifd_new_send_channel_async, p);
+        }
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -977,8 +1117,116 @@ struct {
     uint64_t packet_num;
     /* multifd ops */
     MultiFDMethods *ops;
+    /* array of pages to read, only used with mapped-ram */
+    MultiFDPages_t *pages;
+    /* idle recv channels, only used with mapped-ram */
+    QemuSemaphore channels_ready;
+    /* Only valid values are 0 and 1, see multifd_send_state->exiting */
+    int exiting;
 } *multifd_recv_state;
 
+/*
+ * With mapped-ram there is no packet stream: the loading thread reads
+ * the file bitmaps and hands pages out to the channels, which read
+ * them from their fixed offset.  multifd_recv_state->pages is swapped
+ * with the channel's pages the same way as on the send side.
+ */
+static int multifd_recv_send_pages(void)
+{
+    int i;
+    static int next_channel;
+    MultiFDRecvParams *p = NULL;
+    MultiFDPages_t *pages = multifd_recv_state->pages;
+
+    if (qatomic_read(&multifd_recv_state->exiting)) {
+        return -1;
+    }
+
+    qemu_sem_wait(&multifd_recv_state->channels_ready);
+    next_channel %= migrate_multifd_channels();
+    for (i = next_channel;; i = (i + 1) % migrate_multifd_channels()) {
+        p = &multifd_recv_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        if (p->quit) {
+            error_report("%s: channel %d has already quit!", __func__, i);
+            qemu_mutex_unlock(&p->mutex);
+            return -1;
+        }
+        if (!p->pending_job) {
+            p->pending_job++;
+            next_channel = (i + 1) % migrate_multifd_channels();
+            break;
+        }
+        qemu_mutex_unlock(&p->mutex);
+    }
+    assert(!p->pages->num);
+    assert(!p->pages->block);
+
+    multifd_recv_state->pages = p->pages;
+    p->pages = pages;
+    qemu_mutex_unlock(&p->mutex);
+    qemu_sem_post(&p->sem);
+
+    return 1;
+}
+
+int multifd_recv_queue_page(RAMBlock *block, ram_addr_t offset)
+{
+    MultiFDPages_t *pages = multifd_recv_state->pages;
+    bool changed = false;
+
+    if (!pages->block) {
+        pages->block = block;
+    }
+
+    if (pages->block == block) {
+        pages->offset[pages->num] = offset;
+        pages->num++;
+
+        if (pages->num < pages->allocated) {
+            return 1;
+        }
+    } else {
+        changed = true;
+    }
+
+    if (multifd_recv_send_pages() < 0) {
+        return -1;
+    }
+
+    if (changed) {
+        return multifd_recv_queue_page(block, offset);
+    }
+
+    return 1;
+}
+
+/**
+ * multifd_recv_flush_pages: wait until all queued pages are loaded
+ *
+ * Returns 0 for success or -1 for error
+ */
+static int multifd_recv_flush_pages(void)
+{
+    int i;
+
+    if (multifd_recv_state->pages->num &&
+        multifd_recv_send_pages() < 0) {
+        return -1;
+    }
+
+    /* All channels are idle once we got every one of them back */
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        qemu_sem_wait(&multifd_recv_state->channels_ready);
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        qemu_sem_post(&multifd_recv_state->channels_ready);
+    }
+
+    return qatomic_read(&multifd_recv_state->exiting) ? -1 : 0;
+}
+
 static void multifd_recv_terminate_threads(Error *err)
 {
     int i;
@@ -995,11 +1243,16 @@ static void multifd_recv_terminate_threads(Error *err)
         }
     }
 
+    qatomic_set(&multifd_recv_state->exiting, 1);
+    /* Don't leave channels waiting for a LISTEN that won't come */
+    qemu_event_set(&migration_incoming_get_current()->postcopy_listen_event);
+
     for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
 
         qemu_mutex_lock(&p->mutex);
         p->quit = true;
+        qemu_sem_post(&p->sem);
         /*
          * We could arrive here for two reasons:
          *  - normal quit, i.e. everything went fine, just finished
@@ -1049,8 +1302,13 @@ void multifd_load_cleanup(void)
         p->c = NULL;
         qemu_mutex_destroy(&p->mutex);
         qemu_sem_destroy(&p->sem_sync);
+        qemu_sem_destroy(&p->sem);
         g_free(p->name);
         p->name = NULL;
+        if (p->pages) {
+            multifd_pages_clear(p->pages);
+            p->pages = NULL;
+        }
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
@@ -1058,9 +1316,18 @@ void multifd_load_cleanup(void)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
+        g_free(p->postcopy_buf);
+        p->postcopy_buf = NULL;
         multifd_recv_state->ops->recv_cleanup(p);
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
+    qemu_sem_destroy(&multifd_recv_state->channels_ready);
+    if (multifd_recv_state->pages) {
+        multifd_pages_clear(multifd_recv_state->pages);
+        multifd_recv_state->pages = NULL;
+    }
     g_free(multifd_recv_state->params);
     multifd_recv_state->params = NULL;
     g_free(multifd_recv_state);
@@ -1074,6 +1341,12 @@ void multifd_recv_sync_main(void)
     if (!migrate_use_multifd()) {
         return;
     }
+    if (migrate_mapped_ram()) {
+        if (multifd_recv_flush_pages() < 0) {
+            error_report("%s: multifd_recv_flush_pages fail", __func__);
+        }
+        return;
+    }
     for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
 
@@ -1094,6 +1367,170 @@ void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/**
+ * multifd_file_read_pages: read the pages of a job from the file
+ *
+ * Contiguous pages are coalesced into a single read.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int multifd_file_read_pages(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    RAMBlock *block = pages->block;
+    uint32_t i, j;
+
+    for (i = 0; i < pages->num; i = j) {
+        ram_addr_t start = pages->offset[i];
+
+        for (j = i + 1; j < pages->num &&
+             pages->offset[j] == pages->offset[j - 1] + p->page_size; j++) {
+            /* nothing */
+        }
+
+        if (qio_channel_pread_all(p->c, (char *)block->host + start,
+                                  (j - i) * p->page_size,
+                                  block->pages_offset + start, errp) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int multifd_recv_file_loop(MultiFDRecvParams *p, Error **errp)
+{
+    while (true) {
+        qemu_sem_wait(&p->sem);
+
+        qemu_mutex_lock(&p->mutex);
+        if (p->quit) {
+            qemu_mutex_unlock(&p->mutex);
+            break;
+        }
+        if (!p->pending_job) {
+            /* sometimes there are spurious wakeups */
+            qemu_mutex_unlock(&p->mutex);
+            continue;
+        }
+        qemu_mutex_unlock(&p->mutex);
+
+        if (multifd_file_read_pages(p, errp) < 0) {
+            return -1;
+        }
+
+        trace_multifd_recv(p->id, p->num_packets, p->pages->num, 0, 0, 0);
+        p->num_packets++;
+        p->total_normal_pages += p->pages->num;
+
+        qemu_mutex_lock(&p->mutex);
+        p->pages->num = 0;
+        p->pages->block = NULL;
+        p->pending_job--;
+        qemu_mutex_unlock(&p->mutex);
+
+        qemu_sem_post(&multifd_recv_state->channels_ready);
+    }
+
+    return 0;
+}
+
+/**
+ * multifd_recv_postcopy_pages: place the pages of a postcopy packet
+ *
+ * Wait until the destination listens, at which point guest memory is
+ * registered with userfaultfd and the pages can't be written in place.  Read them into the channel bounce buffer
+ * and let UFFDIO_COPY install each of them atomically, waking up any
+ * vcpu that faulted on it.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int multifd_recv_postcopy_pages(MultiFDRecvParams *p, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    PostcopyState ps;
+    int ret;
+
+    if (!p->postcopy_buf) {
+        error_setg(errp, "multifd %u: postcopy packet received without "
+                   "postcopy-multifd", p->id);
+        return -1;
+    }
+    if (flags != MULTIFD_FLAG_NOCOMP) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_NOCOMP);
+        return -1;
+    }
+    if (!p->normal_num && !p->zero_num) {
+        return 0;
+    }
+    if (qemu_ram_pagesize(p->block) != p->page_size) {
+        error_setg(errp, "multifd %u: postcopy packet for ramblock %s "
+                   "with host page size %zu", p->id, p->block->idstr,
+                   qemu_ram_pagesize(p->block));
+        return -1;
+    }
+
+    /*
+     * The source starts sending postcopy pages right after the LISTEN
+     * command, but the main thread may not have processed it yet.  Until
+     * it has, userfaultfd is not registered and pages cannot be placed.
+     */
+    qemu_event_wait(&mis->postcopy_listen_event);
+    if (qatomic_read(&multifd_recv_state->exiting)) {
+        /* Woken up by multifd_recv_terminate_threads(), nothing to report */
+        return -1;
+    }
+    ps = postcopy_state_get();
+    if (ps != POSTCOPY_INCOMING_LISTENING && ps != POSTCOPY_INCOMING_RUNNING) {
+        error_setg(errp, "multifd %u: postcopy packet received in postcopy "
+                   "state %d", p->id, ps);
+        return -1;
+    }
+
+    for (int i = 0; i < p->normal_num; i++) {
+        p->iov[i].iov_base = p->postcopy_buf + i * p->page_size;
+        p->iov[i].iov_len = p->page_size;
+    }
+    if (p->normal_num) {
+        ret = qio_channel_readv_all(p->c, p->iov, p->normal_num, errp);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    for (int i = 0; i < p->normal_num; i++) {
+        ret = postcopy_place_page(mis, p->host + p->normal[i],
+                                  p->postcopy_buf + i * p->page_size,
+                                  p->block);
+        if (ret) {
+            error_setg_errno(errp, -ret, "multifd %u: failed to place page "
+                             "at offset 0x" RAM_ADDR_FMT, p->id,
+                             p->normal[i]);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < p->zero_num; i++) {
+        ret = postcopy_place_page_zero(mis, p->host + p->zero[i], p->block);
+        if (ret) {
+            error_setg_errno(errp, -ret, "multifd %u: failed to place zero "
+                             "page at offset 0x" RAM_ADDR_FMT, p->id,
+                             p->zero[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
@@ -1103,6 +1540,11 @@ static void *multifd_recv_thread(void *opaque)
     trace_multifd_recv_thread_start(p->id);
     rcu_register_thread();
 
+    if (migrate_mapped_ram()) {
+        multifd_recv_file_loop(p, &local_err);
+        goto out;
+    }
+
     while (true) {
         uint32_t flags;
 
@@ -1126,17 +1568,34 @@ static void *multifd_recv_thread(void *opaque)
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
-        trace_multifd_recv(p->id, p->packet_num, p->normal_num, flags,
-                           p->next_packet_size);
+        trace_multifd_recv(p->id, p->packet_num, p->normal_num, p->zero_num,
+                           flags, p->next_packet_size);
         p->num_packets++;
         p->total_normal_pages += p->normal_num;
+        p->total_zero_pages += p->zero_num;
+        p->total_bytes += p->packet_len + p->next_packet_size;
+        p->last_packet_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+        if (!p->first_packet_time) {
+            p->first_packet_time = p->last_packet_time;
+        }
         qemu_mutex_unlock(&p->mutex);
 
-        if (p->normal_num) {
-            ret = multifd_recv_state->ops->recv_pages(p, &local_err);
+        if (flags & MULTIFD_FLAG_POSTCOPY) {
+            ret = multifd_recv_postcopy_pages(p, &local_err);
             if (ret != 0) {
                 break;
             }
+        } else {
+            if (p->normal_num) {
+                ret = multifd_recv_state->ops->recv_pages(p, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+            }
+
+            for (int i = 0; i < p->zero_num; i++) {
+                ram_handle_compressed(p->host + p->zero[i], 0, p->page_size);
+            }
         }
 
         if (flags & MULTIFD_FLAG_SYNC) {
@@ -1145,16 +1604,22 @@ static void *multifd_recv_thread(void *opaque)
         }
     }
 
+out:
     if (local_err) {
         multifd_recv_terminate_threads(local_err);
         error_free(local_err);
+        if (migrate_mapped_ram()) {
+            /* Don't leave the loading thread waiting for this channel */
+            qemu_sem_post(&multifd_recv_state->channels_ready);
+        }
     }
     qemu_mutex_lock(&p->mutex);
     p->running = false;
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -1177,14 +1642,25 @@ int multifd_load_setup(Error **errp)
     multifd_recv_state = g_malloc0(sizeof(*multifd_recv_state));
     multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
     qatomic_set(&multifd_recv_state->count, 0);
+    qatomic_set(&multifd_recv_state->exiting, 0);
     qemu_sem_init(&multifd_recv_state->sem_sync, 0);
+    /* With mapped-ram all channels start idle */
+    qemu_sem_init(&multifd_recv_state->channels_ready, thread_count);
     multifd_recv_state->ops = multifd_ops[migrate_multifd_compression()];
+    if (migrate_mapped_ram()) {
+        multifd_recv_state->pages = multifd_pages_init(page_count);
+    }
 
     for (i = 0; i < thread_count; i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
 
         qemu_mutex_init(&p->mutex);
         qemu_sem_init(&p->sem_sync, 0);
+        qemu_sem_init(&p->sem, 0);
+        p->pending_job = 0;
+        if (migrate_mapped_ram()) {
+            p->pages = multifd_pages_init(page_count);
+        }
         p->quit = false;
         p->id = i;
         p->packet_len = sizeof(MultiFDPacket_t)
@@ -1193,8 +1669,12 @@ int multifd_load_setup(Error **errp)
         p->name = g_strdup_printf("multifdrecv_%d", i);
         p->iov = g_new0(struct iovec, page_count);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
         p->page_count = page_count;
         p->page_size = qemu_target_page_size();
+        if (migrate_postcopy_multifd()) {
+            p->postcopy_buf = g_malloc(page_count * p->page_size);
+        }
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -1211,6 +1691,50 @@ int multifd_load_setup(Error **errp)
     return 0;
 }
 
+/**
+ * multifd_recv_channel_stats: statistics of the receiving channels
+ *
+ * Returns NULL when multifd isn't receiving.  The throughput is the
+ * average between the first and the last packet of each channel, so it
+ * stays meaningful once the channel is idle.  The counters are updated
+ * by the channel threads under the channel mutex.
+ */
+MultiFDChannelStatsList *multifd_recv_channel_stats(void)
+{
+    MultiFDChannelStatsList *head = NULL, **tail = &head;
+    int i;
+
+    if (!multifd_recv_state) {
+        return NULL;
+    }
+
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+        MultiFDChannelStats *stats;
+        int64_t elapsed;
+
+        if (!p->c) {
+            continue;
+        }
+
+        stats = g_new0(MultiFDChannelStats, 1);
+        qemu_mutex_lock(&p->mutex);
+        stats->id = p->id;
+        stats->packets = p->num_packets;
+        stats->normal_pages = p->total_normal_pages;
+        stats->zero_pages = p->total_zero_pages;
+        stats->bytes = p->total_bytes;
+        elapsed = p->last_packet_time - p->first_packet_time;
+        qemu_mutex_unlock(&p->mutex);
+        if (elapsed > 0) {
+            stats->throughput = stats->bytes * 1000 / elapsed;
+        }
+        QAPI_LIST_APPEND(tail, stats);
+    }
+
+    return head;
+}
+
 bool multifd_recv_all_channels_created(void)
 {
     int thread_count = migrate_multifd_channels();
@@ -1237,7 +1761,12 @@ void multifd_recv_new_channel(QIOChannel *ioc, Error **errp)
     Error *local_err = NULL;
     int id;
 
-    id = multifd_recv_initial_packet(ioc, &local_err);
+    if (migrate_mapped_ram()) {
+        /* The channels are opened locally, in order */
+        id = qatomic_read(&multifd_recv_state->count);
+    } else {
+        id = multifd_recv_initial_packet(ioc, &local_err);
+    }
     if (id < 0) {
         multifd_recv_terminate_threads(local_err);
         error_propagate_prepend(errp, local_err,
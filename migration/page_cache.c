@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is set associative, indexed by a hash of the page address
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -23,6 +23,13 @@
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/*
+ * Number of entries a page can live in.  A direct mapped cache drops a
+ * hot page as soon as another page hashes to the same slot; with a few
+ * ways the least recently used entry of the set goes instead.
+ */
+#define PAGE_CACHE_WAYS 4
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
@@ -36,6 +43,9 @@ struct PageCache {
     size_t page_size;
     size_t max_num_items;
     size_t num_items;
+    /* entries per set, PAGE_CACHE_WAYS unless the cache is tiny */
+    size_t num_ways;
+    size_t num_sets;
 };
 
 PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
@@ -66,6 +76,8 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
     cache->page_size = page_size;
     cache->num_items = 0;
     cache->max_num_items = num_pages;
+    cache->num_ways = MIN(num_pages, PAGE_CACHE_WAYS);
+    cache->num_sets = num_pages / cache->num_ways;
 
     trace_migration_pagecache_init(cache->max_num_items);
 
@@ -103,28 +115,36 @@ void cache_fini(PageCache *cache)
     g_free(cache);
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
-{
-    g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
-}
-
-static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+/* Returns the first entry of the set @address belongs to */
+static CacheItem *cache_get_set(const PageCache *cache, uint64_t address)
 {
-    size_t pos;
+    size_t set;
 
     g_assert(cache);
     g_assert(cache->page_cache);
 
-    pos = cache_get_cache_pos(cache, addr);
+    set = (address / cache->page_size) & (cache->num_sets - 1);
+    return &cache->page_cache[set * cache->num_ways];
+}
 
-    return &cache->page_cache[pos];
+static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+{
+    CacheItem *set = cache_get_set(cache, addr);
+    size_t i;
+
+    for (i = 0; i < cache->num_ways; i++) {
+        if (set[i].it_addr == addr) {
+            return &set[i];
+        }
+    }
+    return NULL;
 }
 
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    return it ? it->it_data : NULL;
 }
 
 bool cache_is_cached(const PageCache *cache, uint64_t addr,
@@ -134,7 +154,7 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
 
     it = cache_get_by_addr(cache, addr);
 
-    if (it->it_addr == addr) {
+    if (it) {
         /* update the it_age when the cache hit */
         it->it_age = current_age;
         return true;
@@ -145,17 +165,34 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
                  uint64_t current_age)
 {
+    CacheItem *set, *it;
+    bool evicted = false;
+    size_t i;
 
-    CacheItem *it;
-
-    /* actual update of entry */
     it = cache_get_by_addr(cache, addr);
+    if (!it) {
+        /* Prefer a free entry, otherwise the one used least recently */
+        set = cache_get_set(cache, addr);
+        it = &set[0];
+        for (i = 0; i < cache->num_ways; i++) {
+            if (!set[i].it_data) {
+                it = &set[i];
+                break;
+            }
+            if (set[i].it_age < it->it_age) {
+                it = &set[i];
+            }
+        }
 
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
-        return -1;
+        if (it->it_data) {
+            if (it->it_age + CACHED_PAGE_LIFETIME > current_age) {
+                /* the whole set is fresh, don't replace any of it */
+                return -1;
+            }
+            evicted = true;
+        }
     }
+
     /* allocate page */
     if (!it->it_data) {
         it->it_data = g_try_malloc(cache->page_size);
@@ -171,5 +208,5 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
     it->it_age = current_age;
     it->it_addr = addr;
 
-    return 0;
+    return evicted ? 1 : 0;
 }
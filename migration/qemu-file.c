@@ -740,6 +740,56 @@ int64_t qemu_file_total_transferred(QEMUFile *f)
     return f->total_transferred;
 }
 
+/*
+ * Returns the current position of @f in its backing channel, taking
+ * into account data still buffered in @f.  Only valid for channels
+ * that support seeking.
+ */
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *local_error = NULL;
+    off_t pos;
+
+    qemu_fflush(f);
+
+    pos = qio_channel_io_seek(f->ioc, 0, SEEK_CUR, &local_error);
+    if (pos < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_error);
+        return pos;
+    }
+
+    if (!qemu_file_is_writable(f)) {
+        pos -= f->buf_size - f->buf_index;
+    }
+    return pos;
+}
+
+/*
+ * Moves @f to @offset in its backing channel.  Pending writes are
+ * flushed first; buffered reads are discarded.
+ */
+void qemu_set_offset(QEMUFile *f, off_t offset, int whence)
+{
+    Error *local_error = NULL;
+    off_t ret;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        /* Drop read ahead data */
+        if (whence == SEEK_CUR) {
+            offset -= f->buf_size - f->buf_index;
+        }
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    ret = qio_channel_io_seek(f->ioc, offset, whence, &local_error);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_error);
+    }
+}
+
 int qemu_file_rate_limit(QEMUFile *f)
 {
     if (f->shutdown) {
@@ -53,6 +53,8 @@
 #include "migration/colo.h"
 #include "block.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/dirtylimit.h"
+#include "qapi/qapi-commands-migration.h"
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
@@ -87,6 +89,17 @@
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
 /* We can't use any flag that is bigger than 0x200 */
 
+/*
+ * mapped-ram file layout: after its idstr and length, each RAMBlock
+ * has a header with the version, the page size, and the file offsets
+ * of its bitmap and of its pages.  The pages region starts at an
+ * aligned offset so that it can be read with O_DIRECT.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+/* version (be32) + page_size, bitmap_offset, pages_offset (be64) */
+#define MAPPED_RAM_HDR_SIZE (4 + 3 * 8)
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+
 int (*xbzrle_encode_buffer_func)(uint8_t *, uint8_t *, int,
      uint8_t *, int) = xbzrle_encode_buffer;
 #if defined(CONFIG_AVX512BW_OPT)
@@ -129,6 +142,8 @@ struct PageSearchStatus {
     unsigned long page;
     /* Set once we wrap around */
     bool         complete_round;
+    /* Whether the current page was requested by the destination */
+    bool         postcopy_requested;
     /* Whether we're sending a host page */
     bool          host_page_sending;
     /* The start/end of current host page.  Invalid if host_page_sending==false */
@@ -353,6 +368,42 @@ struct RAMSrcPageRequest {
     QSIMPLEQ_ENTRY(RAMSrcPageRequest) next_req;
 };
 
+/*
+ * The dirty bitmap sync is split in shards of at least this many
+ * target pages (1GiB with 4K pages), so that big RAMBlocks can be
+ * merged into the migration bitmap by several threads at once.
+ */
+#define BITMAP_SYNC_SHARD_PAGES (1ULL << 18)
+
+typedef struct {
+    RAMBlock *rb;
+    ram_addr_t start;
+    ram_addr_t length;
+} BitmapSyncShard;
+
+typedef struct BitmapSyncPool BitmapSyncPool;
+
+typedef struct {
+    BitmapSyncPool *pool;
+    QemuThread thread;
+    /* new dirty pages found by this worker during the last sync */
+    uint64_t dirty_pages;
+} BitmapSyncWorker;
+
+struct BitmapSyncPool {
+    BitmapSyncWorker *workers;
+    int nr_workers;
+    /* posted once per worker to start a sync, or to quit */
+    QemuSemaphore work_sem;
+    /* posted by each worker when it has no shards left */
+    QemuSemaphore done_sem;
+    bool quit;
+    /* shards of the current sync, filled by the migration thread */
+    GArray *shards;
+    /* next shard to be handled, updated atomically */
+    unsigned int next;
+};
+
 /* State of RAM for migration */
 struct RAMState {
     /*
@@ -372,6 +423,10 @@ struct RAMState {
     uint32_t last_version;
     /* How many times we have dirty too many pages */
     int dirty_rate_high_cnt;
+    /* Whether the dirty-limit capability put a limit on the vCPUs */
+    bool dirty_limit_active;
+    /* Part of the dirty rate budget left after repeated triggers */
+    uint64_t dirty_limit_pct;
     /* these variables are used for bitmap sync */
     /* last time we did a full bitmap_sync */
     int64_t time_last_bitmap_sync;
@@ -415,6 +470,8 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /* Helper threads for the dirty bitmap sync, NULL if it is serial */
+    BitmapSyncPool *sync_pool;
 };
 typedef struct RAMState RAMState;
 
@@ -547,6 +604,7 @@ static void pss_init(PageSearchStatus *pss, RAMBlock *rb, ram_addr_t page)
     pss->block = rb;
     pss->page = page;
     pss->complete_round = false;
+    pss->postcopy_requested = false;
 }
 
 /*
@@ -751,6 +809,106 @@ static void mig_throttle_guest_down(uint64_t bytes_dirty_period,
     }
 }
 
+static int dirty_rate_cmp(const void *a, const void *b)
+{
+    uint64_t ra = *(const uint64_t *)a, rb = *(const uint64_t *)b;
+
+    return ra < rb ? -1 : ra > rb;
+}
+
+/**
+ * migration_dirty_limit_guest: limit the dirty rate of the heavy writers
+ *
+ * Unlike mig_throttle_guest_down(), which slows all vCPUs down by the
+ * same amount, this caps the dirty page rate of each vCPU with the dirty
+ * ring based dirtylimit.  The guest as a whole may dirty what can be sent
+ * within downtime-limit over a sync period (and no more than the
+ * throttle trigger threshold).  That budget is water-filled over the
+ * vCPU dirty rates: vCPUs below their share keep running unthrottled,
+ * the heavy writers split what is left.  Every further trigger shrinks
+ * the budget by cpu-throttle-increment percent.
+ *
+ * @rs: current RAM state
+ * @bytes_xfer_period: bytes sent during the last period
+ * @bytes_dirty_threshold: dirty bytes over which the throttle triggers
+ */
+static void migration_dirty_limit_guest(RAMState *rs,
+                                        uint64_t bytes_xfer_period,
+                                        uint64_t bytes_dirty_threshold)
+{
+    MigrationState *s = migrate_get_current();
+    int64_t period = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) -
+                     rs->time_last_bitmap_sync;
+    g_autofree uint64_t *rates = NULL;
+    uint64_t budget, quota, remaining;
+    Error *local_err = NULL;
+    CPUState *cpu;
+    int i, n = 0;
+
+    period = MAX(period, 1);
+
+    if (!rs->dirty_limit_active) {
+        rs->dirty_limit_pct = 100;
+    } else {
+        rs->dirty_limit_pct = rs->dirty_limit_pct *
+            (100 - s->parameters.cpu_throttle_increment) / 100;
+    }
+
+    /* Bytes the guest may dirty per period, then in MB/s */
+    budget = MIN(bytes_dirty_threshold,
+                 bytes_xfer_period * s->parameters.downtime_limit / period);
+    budget = budget * rs->dirty_limit_pct / 100;
+    budget = MAX((budget * 1000 / period) >> 20, 1);
+    quota = budget;
+
+    /* The vCPU dirty rates are only measured once the limit is in place */
+    if (dirtylimit_in_service()) {
+        CPU_FOREACH(cpu) {
+            n++;
+        }
+        rates = g_new(uint64_t, n);
+        i = 0;
+        CPU_FOREACH(cpu) {
+            rates[i++] = vcpu_dirty_rate_get(cpu->cpu_index);
+        }
+        qsort(rates, n, sizeof(*rates), dirty_rate_cmp);
+
+        remaining = budget;
+        for (i = 0; i < n; i++) {
+            quota = remaining / (n - i);
+            if (rates[i] > quota) {
+                break;
+            }
+            remaining -= rates[i];
+        }
+        quota = MAX(quota, 1);
+    }
+
+    trace_migration_dirty_limit_guest(budget, quota);
+
+    qmp_set_vcpu_dirty_limit(false, -1, quota, &local_err);
+    if (local_err) {
+        error_report_err(local_err);
+        return;
+    }
+    rs->dirty_limit_active = true;
+}
+
+/**
+ * ram_dirty_limit_stop: lift the vCPU dirty limit set by migration
+ *
+ * Must be called with the BQL held.
+ */
+void ram_dirty_limit_stop(void)
+{
+    RAMState *rs = ram_state;
+
+    if (rs && rs->dirty_limit_active) {
+        qmp_cancel_vcpu_dirty_limit(false, -1, NULL);
+        rs->dirty_limit_active = false;
+    }
+}
+
 void mig_throttle_counter_reset(void)
 {
     RAMState *rs = ram_state;
@@ -776,8 +934,10 @@ static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
 {
     /* We don't care if this fails to allocate a new cache page
      * as long as it updated an old one */
-    cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
-                 ram_counters.dirty_sync_count);
+    if (cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
+                     ram_counters.dirty_sync_count) == 1) {
+        xbzrle_counters.cache_eviction++;
+    }
 }
 
 #define ENCODING_FLAG_XBZRLE 0x1
@@ -803,15 +963,20 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
     int encoded_len = 0, bytes_xbzrle;
     uint8_t *prev_cached_page;
     QEMUFile *file = pss->pss_channel;
+    int ret;
 
     if (!cache_is_cached(XBZRLE.cache, current_addr,
                          ram_counters.dirty_sync_count)) {
         xbzrle_counters.cache_miss++;
         if (!rs->last_stage) {
-            if (cache_insert(XBZRLE.cache, current_addr, *current_data,
-                             ram_counters.dirty_sync_count) == -1) {
+            ret = cache_insert(XBZRLE.cache, current_addr, *current_data,
+                               ram_counters.dirty_sync_count);
+            if (ret == -1) {
                 return -1;
             } else {
+                if (ret == 1) {
+                    xbzrle_counters.cache_eviction++;
+                }
                 /* update *current_data when the page has been
                    inserted into cache */
                 *current_data = get_cached_data(XBZRLE.cache, current_addr);
@@ -819,6 +984,7 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
         }
         return -1;
     }
+    xbzrle_counters.cache_hit++;
 
     /*
      * Reaching here means the page has hit the xbzrle cache, no matter what
@@ -1108,6 +1274,163 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/* Called with RCU critical section */
+static uint64_t bitmap_sync_run_shards(BitmapSyncPool *pool)
+{
+    uint64_t new_dirty_pages = 0;
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&pool->next)) < pool->shards->len) {
+        BitmapSyncShard *shard = &g_array_index(pool->shards,
+                                                BitmapSyncShard, i);
+
+        new_dirty_pages += cpu_physical_memory_sync_dirty_bitmap(shard->rb,
+                                                                 shard->start,
+                                                                 shard->length);
+    }
+    return new_dirty_pages;
+}
+
+static void *bitmap_sync_thread(void *opaque)
+{
+    BitmapSyncWorker *worker = opaque;
+    BitmapSyncPool *pool = worker->pool;
+
+    rcu_register_thread();
+
+    while (true) {
+        qemu_sem_wait(&pool->work_sem);
+        if (qatomic_read(&pool->quit)) {
+            break;
+        }
+        WITH_RCU_READ_LOCK_GUARD() {
+            worker->dirty_pages = bitmap_sync_run_shards(pool);
+        }
+        qemu_sem_post(&pool->done_sem);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/**
+ * bitmap_sync_pool_new: create the dirty bitmap sync helpers
+ *
+ * Returns NULL if the sync has to be done by the migration thread alone.
+ *
+ * @threads: total number of threads doing the sync, including the
+ *           migration thread itself
+ */
+static BitmapSyncPool *bitmap_sync_pool_new(int threads)
+{
+    BitmapSyncPool *pool;
+    int i;
+
+    if (threads <= 1) {
+        return NULL;
+    }
+
+    pool = g_new0(BitmapSyncPool, 1);
+    pool->nr_workers = threads - 1;
+    pool->workers = g_new0(BitmapSyncWorker, pool->nr_workers);
+    pool->shards = g_array_new(false, false, sizeof(BitmapSyncShard));
+    qemu_sem_init(&pool->work_sem, 0);
+    qemu_sem_init(&pool->done_sem, 0);
+
+    for (i = 0; i < pool->nr_workers; i++) {
+        pool->workers[i].pool = pool;
+        qemu_thread_create(&pool->workers[i].thread, "mig/bitmap-sync",
+                           bitmap_sync_thread, &pool->workers[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    return pool;
+}
+
+static void bitmap_sync_pool_free(BitmapSyncPool *pool)
+{
+    int i;
+
+    if (!pool) {
+        return;
+    }
+
+    qatomic_set(&pool->quit, true);
+    for (i = 0; i < pool->nr_workers; i++) {
+        qemu_sem_post(&pool->work_sem);
+    }
+    for (i = 0; i < pool->nr_workers; i++) {
+        qemu_thread_join(&pool->workers[i].thread);
+    }
+    qemu_sem_destroy(&pool->work_sem);
+    qemu_sem_destroy(&pool->done_sem);
+    g_array_free(pool->shards, true);
+    g_free(pool->workers);
+    g_free(pool);
+}
+
+/*
+ * Called with RCU critical section and bitmap_mutex held.
+ *
+ * Split the RAMBlocks into shards and let the migration thread and the
+ * helpers pull shards until all of them are merged into the migration
+ * bitmap.  Shards never share a word of the destination bitmap, nor a
+ * chunk of the clear bitmap.
+ */
+static void ramblock_sync_dirty_bitmap_all(RAMState *rs)
+{
+    BitmapSyncPool *pool = rs->sync_pool;
+    uint64_t new_dirty_pages;
+    RAMBlock *block;
+    int wake, i;
+
+    if (!pool) {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            ramblock_sync_dirty_bitmap(rs, block);
+        }
+        return;
+    }
+
+    g_array_set_size(pool->shards, 0);
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t shard_size = (ram_addr_t)MAX(BITMAP_SYNC_SHARD_PAGES,
+                                    1ULL << block->clear_bmap_shift)
+                                << TARGET_PAGE_BITS;
+        ram_addr_t start;
+
+        for (start = 0; start < block->used_length; start += shard_size) {
+            BitmapSyncShard shard = {
+                .rb = block,
+                .start = start,
+                .length = MIN(shard_size, block->used_length - start),
+            };
+
+            g_array_append_val(pool->shards, shard);
+        }
+    }
+
+    /* Only wake as many helpers as there are shards left for them */
+    wake = MIN(pool->nr_workers, (int)pool->shards->len - 1);
+    for (i = 0; i < pool->nr_workers; i++) {
+        pool->workers[i].dirty_pages = 0;
+    }
+    qatomic_set(&pool->next, 0);
+    for (i = 0; i < wake; i++) {
+        qemu_sem_post(&pool->work_sem);
+    }
+
+    new_dirty_pages = bitmap_sync_run_shards(pool);
+
+    for (i = 0; i < wake; i++) {
+        qemu_sem_wait(&pool->done_sem);
+    }
+    for (i = 0; i < pool->nr_workers; i++) {
+        new_dirty_pages += pool->workers[i].dirty_pages;
+    }
+
+    rs->migration_dirty_pages += new_dirty_pages;
+    rs->num_dirty_pages_period += new_dirty_pages;
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1200,7 +1523,8 @@ static void migration_trigger_throttle(RAMState *rs)
     /* During block migration the auto-converge logic incorrectly detects
      * that ram migration makes no progress. Avoid this by disabling the
      * throttling logic during the bulk phase of block migration. */
-    if (migrate_auto_converge() && !blk_mig_bulk_active()) {
+    if ((migrate_auto_converge() || migrate_dirty_limit()) &&
+        !blk_mig_bulk_active()) {
         /* The following detection logic can be refined later. For now:
            Check to see if the ratio between dirtied bytes and the approx.
            amount of bytes that just got transferred since the last time
@@ -1211,15 +1535,20 @@ static void migration_trigger_throttle(RAMState *rs)
             (++rs->dirty_rate_high_cnt >= 2)) {
             trace_migration_throttle();
             rs->dirty_rate_high_cnt = 0;
-            mig_throttle_guest_down(bytes_dirty_period,
-                                    bytes_dirty_threshold);
+            if (migrate_dirty_limit()) {
+                migration_dirty_limit_guest(rs, bytes_xfer_period,
+                                            bytes_dirty_threshold);
+            } else {
+                mig_throttle_guest_down(bytes_dirty_period,
+                                        bytes_dirty_threshold);
+            }
         }
     }
 }
 
 static void migration_bitmap_sync(RAMState *rs)
 {
-    RAMBlock *block;
+    int64_t start_us, sync_us;
     int64_t end_time;
 
     ram_counters.dirty_sync_count++;
@@ -1229,19 +1558,22 @@ static void migration_bitmap_sync(RAMState *rs)
     }
 
     trace_migration_bitmap_sync_start();
+    start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     memory_global_dirty_log_sync();
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
-        }
+        ramblock_sync_dirty_bitmap_all(rs);
         ram_counters.remaining = ram_bytes_remaining();
     }
     qemu_mutex_unlock(&rs->bitmap_mutex);
 
     memory_global_after_dirty_log_sync();
-    trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
+    sync_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_us;
+    ram_counters.dirty_sync_time = sync_us;
+    ram_counters.dirty_sync_time_max = MAX(ram_counters.dirty_sync_time_max,
+                                           sync_us);
+    trace_migration_bitmap_sync_end(rs->num_dirty_pages_period, sync_us);
 
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
@@ -1460,6 +1792,53 @@ static int ram_save_multifd_page(QEMUFile *file, RAMBlock *block,
     if (multifd_queue_page(file, block, offset) < 0) {
         return -1;
     }
+    /*
+     * When the channel threads decide whether a page is zero or
+     * normal, they account for it themselves.
+     */
+    if (!multifd_send_detects_zero_pages()) {
+        stat64_add(&ram_atomic_counters.normal, 1);
+    }
+
+    return 1;
+}
+
+/**
+ * ram_save_mapped_ram_page: write one page at its offset in the file
+ *
+ * Zero pages are not written, they are only cleared in the file
+ * bitmap: whatever was written at their offset before is ignored on
+ * load, and the destination RAM starts zeroed.
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * @pss: current PSS channel
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_mapped_ram_page(PageSearchStatus *pss, RAMBlock *block,
+                                    ram_addr_t offset)
+{
+    QEMUFile *file = pss->pss_channel;
+    uint8_t *p = block->host + offset;
+    Error *local_err = NULL;
+
+    if (buffer_is_zero(p, TARGET_PAGE_SIZE)) {
+        clear_bit(offset >> TARGET_PAGE_BITS, block->file_bmap);
+        stat64_add(&ram_atomic_counters.duplicate, 1);
+        return 1;
+    }
+
+    if (qio_channel_pwrite_all(qemu_file_get_ioc(file), (char *)p,
+                               TARGET_PAGE_SIZE, block->pages_offset + offset,
+                               &local_err) < 0) {
+        qemu_file_set_error_obj(file, -EIO, local_err);
+        return -1;
+    }
+    set_bit(offset >> TARGET_PAGE_BITS, block->file_bmap);
+
+    qemu_file_acct_rate_limit(file, TARGET_PAGE_SIZE);
+    ram_transferred_add(TARGET_PAGE_SIZE);
     stat64_add(&ram_atomic_counters.normal, 1);
 
     return 1;
@@ -2333,6 +2712,25 @@ static bool save_compress_page(RAMState *rs, PageSearchStatus *pss,
     return false;
 }
 
+/*
+ * Postcopy needs one whole host page to be placed atomically, and the
+ * dest guest must never see a partially copied page.  So by default
+ * multifd is not used in postcopy at all.  With postcopy-multifd the
+ * destination places each page of a packet with UFFDIO_COPY, which
+ * works as long as a host page is a single target page.  Pages faulted
+ * by the destination still go through the main channel, so they don't
+ * queue behind the background push.
+ */
+static bool multifd_can_send_page(PageSearchStatus *pss)
+{
+    if (!migration_in_postcopy()) {
+        return true;
+    }
+
+    return migrate_postcopy_multifd() && !pss->postcopy_requested &&
+           qemu_ram_pagesize(pss->block) == TARGET_PAGE_SIZE;
+}
+
 /**
  * ram_save_target_page_legacy: save one target page
  *
@@ -2355,6 +2753,19 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
         return 1;
     }
 
+    /*
+     * Leave zero page detection to the multifd channels when they are
+     * going to send this page anyway.
+     */
+    if (migrate_use_multifd() && multifd_send_detects_zero_pages() &&
+        multifd_can_send_page(pss)) {
+        return ram_save_multifd_page(pss->pss_channel, block, offset);
+    }
+
+    if (migrate_mapped_ram()) {
+        return ram_save_mapped_ram_page(pss, block, offset);
+    }
+
     res = save_zero_page(pss, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
@@ -2368,13 +2779,7 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
         return res;
     }
 
-    /*
-     * Do not use multifd in postcopy as one whole host page should be
-     * placed.  Meanwhile postcopy requires atomic update of pages, so even
-     * if host page size == guest page size the dest guest during run may
-     * still see partially copied pages which is data corruption.
-     */
-    if (migrate_use_multifd() && !migration_in_postcopy()) {
+    if (migrate_use_multifd() && multifd_can_send_page(pss)) {
         return ram_save_multifd_page(pss->pss_channel, block, offset);
     }
 
@@ -2606,7 +3011,8 @@ static int ram_find_and_save_block(RAMState *rs)
     pss_init(pss, rs->last_seen_block, rs->last_page);
 
     while (true){
-        if (!get_queued_page(rs, pss)) {
+        pss->postcopy_requested = get_queued_page(rs, pss);
+        if (!pss->postcopy_requested) {
             /* priority queue empty, so just search for something dirty */
             int res = find_dirty_block(rs, pss);
             if (res != PAGE_DIRTY_FOUND) {
@@ -2683,6 +3089,7 @@ static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
         migration_page_queue_free(*rsp);
+        bitmap_sync_pool_free((*rsp)->sync_pool);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
         g_free(*rsp);
@@ -2731,6 +3138,8 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
@@ -3152,6 +3561,8 @@ static int ram_init_all(RAMState **rsp)
         return -1;
     }
 
+    (*rsp)->sync_pool =
+        bitmap_sync_pool_new(migrate_get_current()->bitmap_sync_threads);
     ram_init_bitmaps(*rsp);
 
     return 0;
@@ -3245,6 +3656,68 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
  * granularity of these critical sections.
  */
 
+/**
+ * mapped_ram_setup_ramblock: reserve the file regions of a RAMBlock
+ *
+ * Writes the mapped-ram header of @block and moves the stream past the
+ * space reserved for its bitmap and pages.
+ *
+ * @file: QEMUFile where to send the data
+ * @block: RAMBlock to set up
+ */
+static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
+{
+    unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+    off_t header_end;
+
+    block->file_bmap = bitmap_new(num_pages);
+
+    header_end = qemu_get_offset(file) + MAPPED_RAM_HDR_SIZE;
+    block->bitmap_offset = header_end;
+    block->pages_offset = ROUND_UP(block->bitmap_offset + bitmap_size,
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    qemu_put_be32(file, MAPPED_RAM_HDR_VERSION);
+    qemu_put_be64(file, TARGET_PAGE_SIZE);
+    qemu_put_be64(file, block->bitmap_offset);
+    qemu_put_be64(file, block->pages_offset);
+
+    /* The migration stream continues after the pages region */
+    qemu_set_offset(file, block->pages_offset + block->used_length, SEEK_SET);
+}
+
+/**
+ * mapped_ram_write_bitmaps: store the file bitmaps of all RAMBlocks
+ *
+ * Returns zero to indicate success and negative for error
+ *
+ * @file: QEMUFile where to send the data
+ */
+static int mapped_ram_write_bitmaps(QEMUFile *file)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(file);
+    Error *local_err = NULL;
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+        size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+        g_autofree unsigned long *le_bitmap = bitmap_new(num_pages);
+
+        bitmap_to_le(le_bitmap, block->file_bmap, num_pages);
+        if (qio_channel_pwrite_all(ioc, (char *)le_bitmap, bitmap_size,
+                                   block->bitmap_offset, &local_err) < 0) {
+            qemu_file_set_error_obj(file, -EIO, local_err);
+            return -EIO;
+        }
+    }
+
+    return 0;
+}
+
 /**
  * ram_save_setup: Setup RAM for migration
  *
@@ -3287,6 +3760,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                mapped_ram_setup_ramblock(f, block);
+            }
         }
     }
 
@@ -3426,29 +3902,15 @@ out:
     return done;
 }
 
-/**
- * ram_save_complete: function called to send the remaining amount of ram
- *
- * Returns zero to indicate success or negative on error
- *
- * Called with iothread lock
- *
- * @f: QEMUFile where to send the data
- * @opaque: RAMState pointer
+/*
+ * Sends all the dirty pages left and ends the RAM section.  Doesn't need
+ * the BQL: the bitmap has to be synced by the caller.
  */
-static int ram_save_complete(QEMUFile *f, void *opaque)
+static int ram_save_flush(QEMUFile *f, RAMState *rs)
 {
-    RAMState **temp = opaque;
-    RAMState *rs = *temp;
     int ret = 0;
 
-    rs->last_stage = !migration_in_colo_state();
-
     WITH_RCU_READ_LOCK_GUARD() {
-        if (!migration_in_postcopy()) {
-            migration_bitmap_sync_precopy(rs);
-        }
-
         ram_control_before_iterate(f, RAM_CONTROL_FINISH);
 
         /* try transferring iterative blocks of memory */
@@ -3483,12 +3945,76 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         return ret;
     }
 
+    /* All pages are in the file now, the bitmaps are final */
+    if (migrate_mapped_ram()) {
+        ret = mapped_ram_write_bitmaps(f);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
     qemu_fflush(f);
 
     return 0;
 }
 
+/**
+ * ram_save_complete: function called to send the remaining amount of ram
+ *
+ * Returns zero to indicate success or negative on error
+ *
+ * Called with iothread lock
+ *
+ * @f: QEMUFile where to send the data
+ * @opaque: RAMState pointer
+ */
+static int ram_save_complete(QEMUFile *f, void *opaque)
+{
+    RAMState **temp = opaque;
+    RAMState *rs = *temp;
+
+    rs->last_stage = !migration_in_colo_state();
+
+    if (!migration_in_postcopy()) {
+        WITH_RCU_READ_LOCK_GUARD() {
+            migration_bitmap_sync_precopy(rs);
+        }
+    }
+
+    return ram_save_flush(f, rs);
+}
+
+/**
+ * ram_save_complete_sync: first half of an asynchronous RAM completion
+ *
+ * Syncs the dirty bitmap for the last time before the switchover.  Must
+ * be called with the BQL held; ram_save_complete_flush() can then send
+ * the pages from another thread.
+ */
+void ram_save_complete_sync(void)
+{
+    RAMState *rs = ram_state;
+
+    rs->last_stage = true;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        migration_bitmap_sync_precopy(rs);
+    }
+}
+
+/**
+ * ram_save_complete_flush: second half of an asynchronous RAM completion
+ *
+ * Returns zero on success, negative on error
+ *
+ * @f: QEMUFile where to send the data, with the section header written
+ */
+int ram_save_complete_flush(QEMUFile *f)
+{
+    return ram_save_flush(f, ram_state);
+}
+
 static void ram_state_pending_estimate(void *opaque, uint64_t *must_precopy,
                                        uint64_t *can_postcopy)
 {
@@ -4255,6 +4781,117 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+/**
+ * read_ramblock_mapped_ram: load the pages of a RAMBlock from the file
+ *
+ * Every page set in @bitmap is read from its offset in the pages
+ * region, either directly or by the multifd channels.  Pages not set
+ * in @bitmap are zero and are left untouched.
+ *
+ * Returns zero to indicate success and negative for error
+ *
+ * @f: QEMUFile where to receive the data
+ * @block: RAMBlock to load
+ * @num_pages: number of pages in @block
+ * @bitmap: pages present in the file
+ */
+static int read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                    unsigned long num_pages,
+                                    unsigned long *bitmap)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    unsigned long set_bit_idx, clear_bit_idx;
+    Error *local_err = NULL;
+
+    for (set_bit_idx = find_first_bit(bitmap, num_pages);
+         set_bit_idx < num_pages;
+         set_bit_idx = find_next_bit(bitmap, num_pages, clear_bit_idx + 1)) {
+        ram_addr_t offset = set_bit_idx << TARGET_PAGE_BITS;
+        size_t size;
+
+        clear_bit_idx = find_next_zero_bit(bitmap, num_pages, set_bit_idx + 1);
+        size = (clear_bit_idx - set_bit_idx) << TARGET_PAGE_BITS;
+
+        if (migrate_use_multifd()) {
+            ram_addr_t end = offset + size;
+
+            for (; offset < end; offset += TARGET_PAGE_SIZE) {
+                if (multifd_recv_queue_page(block, offset) < 0) {
+                    return -EIO;
+                }
+            }
+        } else if (qio_channel_pread_all(ioc, (char *)block->host + offset,
+                                         size, block->pages_offset + offset,
+                                         &local_err) < 0) {
+            error_report_err(local_err);
+            return -EIO;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * parse_ramblock_mapped_ram: read the mapped-ram header of a RAMBlock
+ * and load its pages
+ *
+ * Returns zero to indicate success and negative for error
+ *
+ * @f: QEMUFile where to receive the data
+ * @block: RAMBlock to load
+ * @length: length of @block on the source
+ */
+static int parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                     ram_addr_t length)
+{
+    unsigned long num_pages = length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+    g_autofree unsigned long *le_bitmap = NULL;
+    g_autofree unsigned long *bitmap = NULL;
+    Error *local_err = NULL;
+    uint32_t version;
+    uint64_t page_size, bitmap_offset, pages_offset;
+    int ret;
+
+    version = qemu_get_be32(f);
+    page_size = qemu_get_be64(f);
+    bitmap_offset = qemu_get_be64(f);
+    pages_offset = qemu_get_be64(f);
+
+    if (version != MAPPED_RAM_HDR_VERSION) {
+        error_report("Unsupported mapped-ram version %u for block %s",
+                     version, block->idstr);
+        return -EINVAL;
+    }
+
+    if (page_size != TARGET_PAGE_SIZE) {
+        error_report("Mismatched mapped-ram page size for block %s: "
+                     "%" PRIu64 " != %d", block->idstr, page_size,
+                     TARGET_PAGE_SIZE);
+        return -EINVAL;
+    }
+
+    le_bitmap = bitmap_new(num_pages);
+    bitmap = bitmap_new(num_pages);
+    if (qio_channel_pread_all(qemu_file_get_ioc(f), (char *)le_bitmap,
+                              bitmap_size, bitmap_offset, &local_err) < 0) {
+        error_report_err(local_err);
+        return -EIO;
+    }
+    bitmap_from_le(bitmap, le_bitmap, num_pages);
+
+    block->pages_offset = pages_offset;
+    ret = read_ramblock_mapped_ram(f, block, num_pages, bitmap);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Skip the pages region, the migration stream continues after it */
+    qemu_set_offset(f, pages_offset + length, SEEK_SET);
+
+    return 0;
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -4396,6 +5033,9 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        ret = parse_ramblock_mapped_ram(f, block, length);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
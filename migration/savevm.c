@@ -215,6 +215,9 @@ typedef struct SaveStateEntry {
     void *opaque;
     CompatEntry *compat;
     int is_ram;
+    /* Size and duration of the last full save of the state (vmstate_save) */
+    uint64_t saved_bytes;
+    int64_t save_time_us;
 } SaveStateEntry;
 
 typedef struct SaveState {
@@ -975,6 +978,7 @@ static void save_section_footer(QEMUFile *f, SaveStateEntry *se)
 
 static int vmstate_save(QEMUFile *f, SaveStateEntry *se, JSONWriter *vmdesc)
 {
+    int64_t start_time, start_bytes;
     int ret;
 
     if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
@@ -985,6 +989,9 @@ static int vmstate_save(QEMUFile *f, SaveStateEntry *se, JSONWriter *vmdesc)
         return 0;
     }
 
+    start_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    start_bytes = qemu_file_total_transferred_fast(f);
+
     trace_savevm_section_start(se->idstr, se->section_id);
     save_section_header(f, se, QEMU_VM_SECTION_FULL);
     if (vmdesc) {
@@ -1008,6 +1015,10 @@ static int vmstate_save(QEMUFile *f, SaveStateEntry *se, JSONWriter *vmdesc)
     if (vmdesc) {
         json_writer_end_object(vmdesc);
     }
+
+    se->saved_bytes = qemu_file_total_transferred_fast(f) - start_bytes;
+    se->save_time_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_time;
+    trace_vmstate_save_measured(se->idstr, se->saved_bytes, se->save_time_us);
     return 0;
 }
 /**
@@ -1410,13 +1421,14 @@ void qemu_savevm_state_complete_postcopy(QEMUFile *f)
 }
 
 static
-int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
+int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy,
+                                                bool skip_ram)
 {
     SaveStateEntry *se;
     int ret;
 
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
-        if (!se->ops ||
+        if (!se->ops || (skip_ram && se->is_ram) ||
             (in_postcopy && se->ops->has_postcopy &&
              se->ops->has_postcopy(se->opaque)) ||
             !se->ops->save_live_complete_precopy) {
@@ -1500,6 +1512,112 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
     return 0;
 }
 
+typedef struct SaveVMRamFlush {
+    QEMUFile *f;
+    bool done;
+} SaveVMRamFlush;
+
+static void *savevm_ram_flush_thread(void *opaque)
+{
+    SaveVMRamFlush *flush = opaque;
+    intptr_t ret;
+
+    rcu_register_thread();
+    ret = ram_save_complete_flush(flush->f);
+    rcu_unregister_thread();
+    qatomic_store_release(&flush->done, true);
+
+    return (void *)ret;
+}
+
+/*
+ * Same as the iterable and non-iterable completion in a row, but the
+ * non-iterable device state is saved into a buffer while a helper thread
+ * sends the last RAM pages on @f.  The buffer is appended once RAM and
+ * the other iterable handlers are done, so the stream is unchanged.
+ *
+ * Only the RAM flush leaves the migration thread: the dirty bitmap sync
+ * and the device vmstate handlers need to run in the thread that holds
+ * the BQL.
+ */
+static int qemu_savevm_state_complete_precopy_async(QEMUFile *f,
+                                                    bool inactivate_disks)
+{
+    SaveStateEntry *se, *ram_se = NULL;
+    SaveVMRamFlush flush = { .f = f };
+    QIOChannelBuffer *bioc;
+    QemuThread thread;
+    QEMUFile *fb;
+    bool overlap;
+    int ret, flush_ret;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (se->is_ram) {
+            ram_se = se;
+            break;
+        }
+    }
+    assert(ram_se);
+
+    trace_savevm_state_complete_precopy_async();
+
+    ram_save_complete_sync();
+    trace_savevm_section_start(ram_se->idstr, ram_se->section_id);
+    save_section_header(f, ram_se, QEMU_VM_SECTION_END);
+    qemu_thread_create(&thread, "mig/ram-flush", savevm_ram_flush_thread,
+                       &flush, QEMU_THREAD_JOINABLE);
+
+    bioc = qio_channel_buffer_new(4096);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-device-buffer");
+    fb = qemu_file_new_output(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
+    /* Disks are inactivated below, after the iterable handlers are done */
+    ret = qemu_savevm_state_complete_precopy_non_iterable(fb, false, false);
+    qemu_fflush(fb);
+
+    /* Account the device state that was saved while RAM was in flight */
+    overlap = !qatomic_load_acquire(&flush.done);
+    if (overlap) {
+        migrate_get_current()->device_state_overlap = bioc->usage;
+    }
+    trace_savevm_state_complete_precopy_async_overlap(bioc->usage, overlap);
+
+    flush_ret = (intptr_t)qemu_thread_join(&thread);
+    trace_savevm_section_end(ram_se->idstr, ram_se->section_id, flush_ret);
+    save_section_footer(f, ram_se);
+    if (flush_ret < 0) {
+        qemu_file_set_error(f, flush_ret);
+        ret = flush_ret;
+        goto out;
+    }
+    if (ret) {
+        qemu_file_set_error(f, ret);
+        goto out;
+    }
+
+    ret = qemu_savevm_state_complete_precopy_iterable(f, false, true);
+    if (ret) {
+        goto out;
+    }
+
+    if (inactivate_disks) {
+        ret = bdrv_inactivate_all();
+        if (ret) {
+            error_report("%s: bdrv_inactivate_all() failed (%d)",
+                         __func__, ret);
+            qemu_file_set_error(f, ret);
+            goto out;
+        }
+    }
+
+    qemu_put_buffer(f, bioc->data, bioc->usage);
+
+out:
+    qemu_fclose(fb);
+    return ret;
+}
+
 int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
                                        bool inactivate_disks)
 {
@@ -1515,8 +1633,19 @@ int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
 
     cpu_synchronize_all_states();
 
+    if (!in_postcopy && !iterable_only && migrate_async_device_state() &&
+        f == migrate_get_current()->to_dst_file &&
+        !migration_in_colo_state()) {
+        ret = qemu_savevm_state_complete_precopy_async(f, inactivate_disks);
+        if (ret) {
+            return ret;
+        }
+        goto flush;
+    }
+
     if (!in_postcopy || iterable_only) {
-        ret = qemu_savevm_state_complete_precopy_iterable(f, in_postcopy);
+        ret = qemu_savevm_state_complete_precopy_iterable(f, in_postcopy,
+                                                          false);
         if (ret) {
             return ret;
         }
@@ -1583,6 +1712,36 @@ void qemu_savevm_state_pending_exact(uint64_t *must_precopy,
     }
 }
 
+/*
+ * Estimate what saving the non-iterable state adds to the downtime, on
+ * top of what qemu_savevm_state_pending_*() reported.  @size is the
+ * state reported by the handlers' state_switchover_estimate, @time_us
+ * the time it took to save the state of the other entries the last time
+ * it was saved (an earlier migration, snapshot or COLO checkpoint).
+ */
+void qemu_savevm_state_switchover_estimate(uint64_t *size, int64_t *time_us)
+{
+    SaveStateEntry *se;
+
+    *size = 0;
+    *time_us = 0;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
+            continue;
+        }
+        if (se->vmsd && se->vmsd->early_setup) {
+            /* Saved during qemu_savevm_state_setup(), not at switchover */
+            continue;
+        }
+        if (se->ops && se->ops->state_switchover_estimate) {
+            *size += se->ops->state_switchover_estimate(se->opaque);
+        } else {
+            *time_us += se->save_time_us;
+        }
+    }
+}
+
 void qemu_savevm_state_cleanup(void)
 {
     SaveStateEntry *se;
@@ -1616,6 +1775,11 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
         return -EINVAL;
     }
 
+    if (migrate_mapped_ram()) {
+        error_setg(errp, "mapped-ram and snapshots are incompatible");
+        return -EINVAL;
+    }
+
     migrate_init(ms);
     memset(&ram_counters, 0, sizeof(ram_counters));
     memset(&compression_counters, 0, sizeof(compression_counters));
@@ -2021,6 +2185,9 @@ static int loadvm_postcopy_handle_listen(MigrationIncomingState *mis)
 
     trace_loadvm_postcopy_handle_listen("after uffd");
 
+    /* multifd channels may now place the postcopy pages they receive */
+    qemu_event_set(&mis->postcopy_listen_event);
+
     if (postcopy_notify(POSTCOPY_NOTIFY_INBOUND_LISTEN, &local_err)) {
         error_report_err(local_err);
         return -1;
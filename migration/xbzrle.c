@@ -126,6 +126,24 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+/*
+ * Same as uleb128_decode_small(), but inlined: the decoder reads two
+ * lengths per run and most of them fit in a single byte.
+ */
+static inline int xbzrle_decode_len(const uint8_t *in, uint32_t *n)
+{
+    if (likely(!(in[0] & 0x80))) {
+        *n = in[0];
+        return 1;
+    }
+    /* we exceed 14 bit number */
+    if (in[1] & 0x80) {
+        return -1;
+    }
+    *n = (in[0] & 0x7f) | (in[1] << 7);
+    return 2;
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
@@ -139,7 +157,7 @@ int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
             return -1;
         }
 
-        ret = uleb128_decode_small(src + i, &count);
+        ret = xbzrle_decode_len(src + i, &count);
         if (ret < 0 || (i && !count)) {
             return -1;
         }
@@ -156,7 +174,7 @@ int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
             return -1;
         }
 
-        ret = uleb128_decode_small(src + i, &count);
+        ret = xbzrle_decode_len(src + i, &count);
         if (ret < 0 || !count) {
             return -1;
         }
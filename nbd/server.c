@@ -28,6 +28,7 @@
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "sysemu/iothread.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -78,6 +79,7 @@ static int system_errno_to_nbd_errno(int err)
 /* Definitions for opaque data types */
 
 typedef struct NBDRequestData NBDRequestData;
+typedef struct NBDReplyBuffer NBDReplyBuffer;
 
 struct NBDRequestData {
     NBDClient *client;
@@ -85,6 +87,22 @@ struct NBDRequestData {
     bool complete;
 };
 
+/*
+ * Replies of a request from a connection iothread, collected while it is
+ * handled in the export's AioContext and sent in one go afterwards.  Data
+ * read into the request's buffer stays there until the request is freed and
+ * is only referenced; headers and anything else live on the stack of the
+ * sender and are copied.
+ */
+struct NBDReplyBuffer {
+    Coroutine *co;
+    const uint8_t *payload;
+    size_t payload_len;
+    GArray *iov;
+    GPtrArray *copies;
+    QSLIST_ENTRY(NBDReplyBuffer) next;
+};
+
 struct NBDExport {
     BlockExport common;
 
@@ -101,6 +119,25 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    /*
+     * Iothreads that service the connections of clients, assigned round
+     * robin.  Requests are received and replies sent in the connection's
+     * iothread, only the block layer calls move to the export's AioContext.
+     */
+    IOThread **conn_iothreads;
+    size_t nr_conn_iothreads;
+    size_t next_conn_iothread;
+
+    /*
+     * Requests from connection iothreads that are in the export's
+     * AioContext.  conn_quiescing makes new ones wait in conn_queue until
+     * the end of the drained section.  Protected by conn_lock.
+     */
+    QemuMutex conn_lock;
+    CoQueue conn_queue;
+    bool conn_quiescing;
+    unsigned conn_in_flight;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -128,6 +165,9 @@ struct NBDClient {
     char *tlsauthz;
     QIOChannelSocket *sioc; /* The underlying data channel */
     QIOChannel *ioc; /* The current I/O channel which may differ (eg TLS) */
+    AioContext *ctx; /* Connection iothread's context, NULL to follow exp */
+    /* Requests in the export's AioContext, protected by exp->conn_lock */
+    QSLIST_HEAD(, NBDReplyBuffer) reply_bufs;
 
     Coroutine *recv_coroutine;
 
@@ -140,6 +180,7 @@ struct NBDClient {
     QTAILQ_ENTRY(NBDClient) next;
     int nb_requests;
     bool closing;
+    bool close_negotiated; /* Argument of a close_fn call deferred to a BH */
 
     uint32_t check_align; /* If non-zero, check for aligned client requests */
 
@@ -1352,8 +1393,18 @@ static coroutine_fn int nbd_negotiate(NBDClient *client, Error **errp)
         return ret;
     }
 
-    /* Attach the channel to the same AioContext as the export */
-    if (client->exp && client->exp->common.ctx) {
+    /*
+     * Attach the channel to the next connection iothread of the export, or
+     * else to the same AioContext as the export
+     */
+    if (client->exp && client->exp->nr_conn_iothreads) {
+        NBDExport *exp = client->exp;
+        IOThread *iothread = exp->conn_iothreads[exp->next_conn_iothread++ %
+                                                 exp->nr_conn_iothreads];
+
+        client->ctx = iothread_get_aio_context(iothread);
+        qio_channel_attach_aio_context(client->ioc, client->ctx);
+    } else if (client->exp && client->exp->common.ctx) {
         qio_channel_attach_aio_context(client->ioc, client->exp->common.ctx);
     }
 
@@ -1454,50 +1505,91 @@ static int nbd_receive_request(NBDClient *client, NBDRequest *request,
 
 void nbd_client_get(NBDClient *client)
 {
-    client->refcount++;
+    qatomic_inc(&client->refcount);
+}
+
+static void nbd_client_free(NBDClient *client)
+{
+    qio_channel_detach_aio_context(client->ioc);
+    object_unref(OBJECT(client->sioc));
+    object_unref(OBJECT(client->ioc));
+    if (client->tlscreds) {
+        object_unref(OBJECT(client->tlscreds));
+    }
+    g_free(client->tlsauthz);
+    if (client->exp) {
+        QTAILQ_REMOVE(&client->exp->clients, client, next);
+        blk_exp_unref(&client->exp->common);
+    }
+    g_free(client->export_meta.bitmaps);
+    g_free(client);
+}
+
+/* Unlinks a client of a connection iothread from its export */
+static void nbd_client_free_bh(void *opaque)
+{
+    NBDClient *client = opaque;
+    AioContext *ctx = client->exp->common.ctx;
+
+    aio_context_acquire(ctx);
+    nbd_client_free(client);
+    aio_context_release(ctx);
 }
 
 void nbd_client_put(NBDClient *client)
 {
-    if (--client->refcount == 0) {
+    if (qatomic_fetch_dec(&client->refcount) == 1) {
         /* The last reference should be dropped by client->close,
          * which is called by client_close.
          */
         assert(client->closing);
 
-        qio_channel_detach_aio_context(client->ioc);
-        object_unref(OBJECT(client->sioc));
-        object_unref(OBJECT(client->ioc));
-        if (client->tlscreds) {
-            object_unref(OBJECT(client->tlscreds));
-        }
-        g_free(client->tlsauthz);
-        if (client->exp) {
-            QTAILQ_REMOVE(&client->exp->clients, client, next);
-            blk_exp_unref(&client->exp->common);
+        /*
+         * The export's client list is not accessed from connection
+         * iothreads, leave it to the main loop.
+         */
+        if (client->ctx && !qemu_in_main_thread()) {
+            aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                    nbd_client_free_bh, client);
+            return;
         }
-        g_free(client->export_meta.bitmaps);
-        g_free(client);
+        nbd_client_free(client);
     }
 }
 
+static void nbd_client_close_fn_bh(void *opaque)
+{
+    NBDClient *client = opaque;
+
+    client->close_fn(client, client->close_negotiated);
+}
+
 static void client_close(NBDClient *client, bool negotiated)
 {
-    if (client->closing) {
+    /* Both the main loop and a connection iothread can close the client */
+    if (qatomic_xchg(&client->closing, true)) {
         return;
     }
 
-    client->closing = true;
-
     /* Force requests to finish.  They will drop their own references,
      * then we'll close the socket and free the NBDClient.
      */
     qio_channel_shutdown(client->ioc, QIO_CHANNEL_SHUTDOWN_BOTH,
                          NULL);
 
-    /* Also tell the client, so that they release their reference.  */
+    /*
+     * Also tell the client, so that they release their reference.  The
+     * callback updates state of the NBD server, which belongs to the main
+     * loop, so a connection iothread must not call it directly.
+     */
     if (client->close_fn) {
-        client->close_fn(client, negotiated);
+        if (client->ctx && !qemu_in_main_thread()) {
+            client->close_negotiated = negotiated;
+            aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                    nbd_client_close_fn_bh, client);
+        } else {
+            client->close_fn(client, negotiated);
+        }
     }
 }
 
@@ -1544,6 +1636,9 @@ static void blk_aio_attached(AioContext *ctx, void *opaque)
     exp->common.ctx = ctx;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
+        if (client->ctx) {
+            continue;
+        }
         qio_channel_attach_aio_context(client->ioc, ctx);
 
         assert(client->nb_requests == 0);
@@ -1560,7 +1655,9 @@ static void blk_aio_detach(void *opaque)
     trace_nbd_blk_aio_detach(exp->name, exp->common.ctx);
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        qio_channel_detach_aio_context(client->ioc);
+        if (!client->ctx) {
+            qio_channel_detach_aio_context(client->ioc);
+        }
     }
 
     exp->common.ctx = NULL;
@@ -1571,8 +1668,18 @@ static void nbd_drained_begin(void *opaque)
     NBDExport *exp = opaque;
     NBDClient *client;
 
+    WITH_QEMU_LOCK_GUARD(&exp->conn_lock) {
+        exp->conn_quiescing = true;
+    }
+
+    /*
+     * Clients of connection iothreads keep receiving requests, they are
+     * stopped by nbd_client_enter_export() instead.
+     */
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        client->quiescing = true;
+        if (!client->ctx) {
+            client->quiescing = true;
+        }
     }
 }
 
@@ -1581,7 +1688,15 @@ static void nbd_drained_end(void *opaque)
     NBDExport *exp = opaque;
     NBDClient *client;
 
+    WITH_QEMU_LOCK_GUARD(&exp->conn_lock) {
+        exp->conn_quiescing = false;
+        qemu_co_enter_all(&exp->conn_queue, &exp->conn_lock);
+    }
+
     QTAILQ_FOREACH(client, &exp->clients, next) {
+        if (client->ctx) {
+            continue;
+        }
         client->quiescing = false;
         nbd_client_receive_next_request(client);
     }
@@ -1592,7 +1707,16 @@ static bool nbd_drained_poll(void *opaque)
     NBDExport *exp = opaque;
     NBDClient *client;
 
+    WITH_QEMU_LOCK_GUARD(&exp->conn_lock) {
+        if (exp->conn_in_flight) {
+            return true;
+        }
+    }
+
     QTAILQ_FOREACH(client, &exp->clients, next) {
+        if (client->ctx) {
+            continue;
+        }
         if (client->nb_requests != 0) {
             /*
              * If there's a coroutine waiting for a request on nbd_read_eof()
@@ -1617,6 +1741,18 @@ static void nbd_eject_notifier(Notifier *n, void *data)
     blk_exp_request_shutdown(&exp->common);
 }
 
+static void nbd_export_release_conn_iothreads(NBDExport *exp)
+{
+    size_t i;
+
+    for (i = 0; i < exp->nr_conn_iothreads; i++) {
+        object_unref(OBJECT(exp->conn_iothreads[i]));
+    }
+    g_free(exp->conn_iothreads);
+    exp->conn_iothreads = NULL;
+    exp->nr_conn_iothreads = 0;
+}
+
 void nbd_export_set_on_eject_blk(BlockExport *exp, BlockBackend *blk)
 {
     NBDExport *nbd_exp = container_of(exp, NBDExport, common);
@@ -1646,6 +1782,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
     BlockDirtyBitmapOrStrList *bitmaps;
+    strList *iothreads;
     size_t i;
     int ret;
 
@@ -1686,6 +1823,24 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
         return ret;
     }
 
+    for (iothreads = arg->connection_iothreads; iothreads;
+         iothreads = iothreads->next)
+    {
+        IOThread *iothread = iothread_by_id(iothreads->value);
+
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            nbd_export_release_conn_iothreads(exp);
+            return -EINVAL;
+        }
+        exp->conn_iothreads = g_renew(IOThread *, exp->conn_iothreads,
+                                      exp->nr_conn_iothreads + 1);
+        exp->conn_iothreads[exp->nr_conn_iothreads++] = iothread;
+        object_ref(OBJECT(iothread));
+    }
+    qemu_mutex_init(&exp->conn_lock);
+    qemu_co_queue_init(&exp->conn_queue);
+
     QTAILQ_INIT(&exp->clients);
     exp->name = g_strdup(name);
     exp->description = g_strdup(arg->description);
@@ -1791,6 +1946,8 @@ fail:
     g_free(exp->export_bitmaps);
     g_free(exp->name);
     g_free(exp->description);
+    nbd_export_release_conn_iothreads(exp);
+    qemu_mutex_destroy(&exp->conn_lock);
     return ret;
 }
 
@@ -1860,6 +2017,9 @@ static void nbd_export_delete(BlockExport *blk_exp)
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
     }
+
+    nbd_export_release_conn_iothreads(exp);
+    qemu_mutex_destroy(&exp->conn_lock);
 }
 
 const BlockExportDriver blk_exp_nbd = {
@@ -1870,12 +2030,51 @@ const BlockExportDriver blk_exp_nbd = {
     .request_shutdown   = nbd_export_request_shutdown,
 };
 
+static NBDReplyBuffer *nbd_client_find_reply_buf(NBDClient *client)
+{
+    Coroutine *co = qemu_coroutine_self();
+    NBDReplyBuffer *rb;
+
+    QEMU_LOCK_GUARD(&client->exp->conn_lock);
+    QSLIST_FOREACH(rb, &client->reply_bufs, next) {
+        if (rb->co == co) {
+            return rb;
+        }
+    }
+    return NULL;
+}
+
 static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
                                         unsigned niov, Error **errp)
 {
     int ret;
 
     g_assert(qemu_in_coroutine());
+
+    /*
+     * The channel of a connection iothread is only used in that iothread.
+     * Replies from the export's AioContext are sent by nbd_trip() when the
+     * request is done.
+     */
+    if (client->ctx && client->ctx != qemu_get_current_aio_context()) {
+        NBDReplyBuffer *rb = nbd_client_find_reply_buf(client);
+        unsigned i;
+
+        assert(rb);
+        for (i = 0; i < niov; i++) {
+            struct iovec v = iov[i];
+            const uint8_t *base = v.iov_base;
+
+            if (base < rb->payload ||
+                base + v.iov_len > rb->payload + rb->payload_len) {
+                v.iov_base = g_memdup2(v.iov_base, v.iov_len);
+                g_ptr_array_add(rb->copies, v.iov_base);
+            }
+            g_array_append_val(rb->iov, v);
+        }
+        return 0;
+    }
+
     qemu_co_mutex_lock(&client->send_lock);
     client->send_coroutine = qemu_coroutine_self();
 
@@ -2619,6 +2818,81 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
     }
 }
 
+/*
+ * Moves a request of a client in a connection iothread to the export's
+ * AioContext, where the block layer must be called.  Waits while the export
+ * is in a drained section, so that drain only has to wait for the requests
+ * that already made it in.  Replies are collected in @rb until
+ * nbd_client_leave_export(), referencing rather than copying what lies in
+ * the @len bytes of the request's @data.
+ */
+static void coroutine_fn nbd_client_enter_export(NBDClient *client,
+                                                 NBDReplyBuffer *rb,
+                                                 const uint8_t *data,
+                                                 size_t len)
+{
+    NBDExport *exp = client->exp;
+
+    if (!client->ctx) {
+        return;
+    }
+
+    rb->co = qemu_coroutine_self();
+    rb->payload = data;
+    rb->payload_len = data ? len : 0;
+    rb->iov = g_array_new(false, false, sizeof(struct iovec));
+    rb->copies = g_ptr_array_new_with_free_func(g_free);
+
+    qemu_mutex_lock(&exp->conn_lock);
+    while (exp->conn_quiescing) {
+        qemu_co_queue_wait(&exp->conn_queue, &exp->conn_lock);
+    }
+    exp->conn_in_flight++;
+    QSLIST_INSERT_HEAD(&client->reply_bufs, rb, next);
+    qemu_mutex_unlock(&exp->conn_lock);
+
+    /* The AioContext cannot change until conn_in_flight drops again */
+    if (exp->common.ctx != client->ctx) {
+        aio_co_reschedule_self(exp->common.ctx);
+    }
+}
+
+/*
+ * Returns to the connection iothread and sends the replies collected in
+ * @rb, if @ret says that handling the request succeeded.
+ */
+static int coroutine_fn nbd_client_leave_export(NBDClient *client,
+                                                NBDReplyBuffer *rb, int ret,
+                                                Error **errp)
+{
+    NBDExport *exp = client->exp;
+    struct iovec *iov;
+    unsigned i, niov;
+
+    if (!client->ctx) {
+        return ret;
+    }
+
+    if (qemu_get_current_aio_context() != client->ctx) {
+        aio_co_reschedule_self(client->ctx);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&exp->conn_lock) {
+        QSLIST_REMOVE(&client->reply_bufs, rb, NBDReplyBuffer, next);
+        exp->conn_in_flight--;
+    }
+    aio_wait_kick();
+
+    iov = (struct iovec *)rb->iov->data;
+    for (i = 0; ret >= 0 && i < rb->iov->len; i += niov) {
+        niov = MIN(rb->iov->len - i, IOV_MAX);
+        ret = nbd_co_send_iov(client, iov + i, niov, errp);
+    }
+    g_array_free(rb->iov, true);
+    g_ptr_array_free(rb->copies, true);
+    return ret;
+}
+
 /* Owns a reference to the NBDClient passed as opaque.  */
 static coroutine_fn void nbd_trip(void *opaque)
 {
@@ -2677,7 +2951,11 @@ static coroutine_fn void nbd_trip(void *opaque)
                                      error_get_pretty(export_err), &local_err);
         error_free(export_err);
     } else {
+        NBDReplyBuffer rb;
+
+        nbd_client_enter_export(client, &rb, req->data, request.len);
         ret = nbd_handle_request(client, &request, req->data, &local_err);
+        ret = nbd_client_leave_export(client, &rb, ret, &local_err);
     }
     if (ret < 0) {
         error_prepend(&local_err, "Failed to send reply: ");
@@ -2712,7 +2990,8 @@ static void nbd_client_receive_next_request(NBDClient *client)
         !client->quiescing) {
         nbd_client_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, client);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        aio_co_schedule(client->ctx ?: client->exp->common.ctx,
+                        client->recv_coroutine);
     }
 }
 
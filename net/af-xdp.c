@@ -0,0 +1,595 @@
+/*
+ * AF_XDP network backend.
+ *
+ * Each queue of the backend is an AF_XDP socket bound to one queue of a
+ * host network interface.  Packets are copied between the guest and the
+ * socket's UMEM, a memory area that is shared with the kernel.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <bpf/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <xdp/xsk.h>
+
+#include "clients.h"
+#include "monitor/monitor.h"
+#include "net/net.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "qemu/memalign.h"
+
+
+typedef struct AFXDPState {
+    NetClientState       nc;
+
+    struct xsk_socket    *xsk;
+    struct xsk_ring_cons rx;
+    struct xsk_ring_prod tx;
+    struct xsk_ring_cons cq;
+    struct xsk_ring_prod fq;
+
+    char                 ifname[IFNAMSIZ];
+    int                  ifindex;
+    bool                 read_poll;
+    bool                 write_poll;
+    uint32_t             outstanding_tx;
+
+    /* UMEM frames that are owned by QEMU, used as a LIFO */
+    uint64_t             *pool;
+    uint32_t             n_pool;
+    char                 *buffer;
+    struct xsk_umem      *umem;
+
+    uint32_t             xdp_flags;
+    bool                 inhibit;
+} AFXDPState;
+
+/* Maximum number of packets that are received per wakeup */
+#define AF_XDP_BATCH_SIZE 64
+
+/* How long the kernel busy polls per syscall, with busy-poll-budget */
+#define AF_XDP_BUSY_POLL_USECS 20
+
+static void af_xdp_send(void *opaque);
+static void af_xdp_writable(void *opaque);
+
+static void af_xdp_update_fd_handler(AFXDPState *s)
+{
+    qemu_set_fd_handler(xsk_socket__fd(s->xsk),
+                        s->read_poll ? af_xdp_send : NULL,
+                        s->write_poll ? af_xdp_writable : NULL,
+                        s);
+}
+
+static void af_xdp_read_poll(AFXDPState *s, bool enable)
+{
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_write_poll(AFXDPState *s, bool enable)
+{
+    if (s->write_poll != enable) {
+        s->write_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_poll(NetClientState *nc, bool enable)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (s->read_poll != enable || s->write_poll != enable) {
+        s->read_poll = enable;
+        s->write_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+/* Take back the frames of packets that the kernel has transmitted */
+static void af_xdp_complete_tx(AFXDPState *s)
+{
+    uint32_t idx = 0;
+    uint32_t done, i;
+
+    done = xsk_ring_cons__peek(&s->cq, XSK_RING_CONS__DEFAULT_NUM_DESCS, &idx);
+
+    for (i = 0; i < done; i++) {
+        s->pool[s->n_pool++] = *xsk_ring_cons__comp_addr(&s->cq, idx++);
+    }
+    s->outstanding_tx -= done;
+
+    if (done) {
+        xsk_ring_cons__release(&s->cq, done);
+    }
+}
+
+static void af_xdp_writable(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    af_xdp_complete_tx(s);
+
+    /*
+     * Keep polling while packets are in flight and the kernel needs to be
+     * kicked to send them, polling the socket does that.
+     */
+    if (!s->outstanding_tx || !xsk_ring_prod__needs_wakeup(&s->tx)) {
+        af_xdp_write_poll(s, false);
+    }
+
+    qemu_flush_queued_packets(&s->nc);
+}
+
+/*
+ * Copy packets into free UMEM frames and put them on the Tx ring.
+ *
+ * Returns the number of leading packets that have been queued, the others
+ * don't fit into the ring or the UMEM right now.
+ */
+static int af_xdp_tx(AFXDPState *s, const NetBatchPacket *pkts, int count)
+{
+    uint32_t i, n, n_free, idx = 0;
+
+    af_xdp_complete_tx(s);
+
+    n = MIN(count, s->n_pool);
+    n_free = xsk_prod_nb_free(&s->tx, n);
+    n = MIN(n, n_free);
+    if (!n || !xsk_ring_prod__reserve(&s->tx, n, &idx)) {
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        struct xdp_desc *desc = xsk_ring_prod__tx_desc(&s->tx, idx++);
+
+        desc->addr = s->pool[--s->n_pool];
+        desc->len = iov_to_buf(pkts[i].iov, pkts[i].iovcnt, 0,
+                               xsk_umem__get_data(s->buffer, desc->addr),
+                               XSK_UMEM__DEFAULT_FRAME_SIZE);
+    }
+
+    xsk_ring_prod__submit(&s->tx, n);
+    s->outstanding_tx += n;
+
+    if (xsk_ring_prod__needs_wakeup(&s->tx)) {
+        af_xdp_write_poll(s, true);
+    }
+
+    return n;
+}
+
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    NetBatchPacket pkt = { .iov = iov, .iovcnt = iovcnt };
+    size_t size = iov_size(iov, iovcnt);
+
+    if (size > XSK_UMEM__DEFAULT_FRAME_SIZE) {
+        /* A packet of this size does not fit into a frame */
+        return size;
+    }
+
+    if (!af_xdp_tx(s, &pkt, 1)) {
+        /*
+         * Out of frames or space in the Tx ring.  Poll until we can write,
+         * which also kicks the kernel if it waits for us.
+         */
+        af_xdp_write_poll(s, true);
+        return 0;
+    }
+
+    return size;
+}
+
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
+static int af_xdp_receive_batch(NetClientState *nc,
+                                const NetBatchPacket *pkts, int count)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    int i;
+
+    /* Oversized packets are dropped by af_xdp_receive_iov() */
+    for (i = 0; i < count; i++) {
+        if (iov_size(pkts[i].iov, pkts[i].iovcnt) >
+            XSK_UMEM__DEFAULT_FRAME_SIZE) {
+            break;
+        }
+    }
+
+    return af_xdp_tx(s, pkts, i);
+}
+
+static void af_xdp_send_completed(NetClientState *nc, ssize_t len)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    af_xdp_read_poll(s, true);
+}
+
+/* Hand free frames to the kernel for receiving */
+static void af_xdp_fq_refill(AFXDPState *s, uint32_t n)
+{
+    uint32_t i, idx = 0;
+
+    /* Leave one frame for Tx, just in case */
+    if (s->n_pool < n + 1) {
+        n = s->n_pool ? s->n_pool - 1 : 0;
+    }
+
+    if (!n || !xsk_ring_prod__reserve(&s->fq, n, &idx)) {
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        *xsk_ring_prod__fill_addr(&s->fq, idx++) = s->pool[--s->n_pool];
+    }
+    xsk_ring_prod__submit(&s->fq, n);
+
+    /* The initial fill happens before the socket exists */
+    if (s->xsk && xsk_ring_prod__needs_wakeup(&s->fq)) {
+        /* Receiving stalled for lack of frames, polling wakes it up */
+        af_xdp_read_poll(s, true);
+    }
+}
+
+static void af_xdp_send(void *opaque)
+{
+    AFXDPState *s = opaque;
+    uint32_t i, n_rx, idx = 0;
+
+    n_rx = xsk_ring_cons__peek(&s->rx, AF_XDP_BATCH_SIZE, &idx);
+    if (!n_rx) {
+        return;
+    }
+
+    /* Let the peer make all packets of this wakeup visible at once */
+    qemu_send_burst_begin(&s->nc);
+
+    for (i = 0; i < n_rx; i++) {
+        const struct xdp_desc *desc;
+        struct iovec iov;
+
+        desc = xsk_ring_cons__rx_desc(&s->rx, idx++);
+
+        iov.iov_base = xsk_umem__get_data(s->buffer, desc->addr);
+        iov.iov_len = desc->len;
+
+        /* The packet is copied if it has to be queued */
+        s->pool[s->n_pool++] = desc->addr;
+
+        if (!qemu_sendv_packet_async(&s->nc, &iov, 1,
+                                     af_xdp_send_completed)) {
+            /*
+             * The peer does not receive anymore.  Stop reading until
+             * af_xdp_send_completed(), and leave the packets that were not
+             * looked at in the ring.
+             */
+            af_xdp_read_poll(s, false);
+            xsk_ring_cons__cancel(&s->rx, n_rx - i - 1);
+            n_rx = i + 1;
+            break;
+        }
+    }
+
+    qemu_send_burst_end(&s->nc);
+
+    xsk_ring_cons__release(&s->rx, n_rx);
+    af_xdp_fq_refill(s, AF_XDP_BATCH_SIZE);
+}
+
+static void af_xdp_cleanup(NetClientState *nc)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+
+    af_xdp_poll(nc, false);
+
+    xsk_socket__delete(s->xsk);
+    s->xsk = NULL;
+    g_free(s->pool);
+    s->pool = NULL;
+    xsk_umem__delete(s->umem);
+    s->umem = NULL;
+    qemu_vfree(s->buffer);
+    s->buffer = NULL;
+
+    /*
+     * The default program is shared by all queues.  Queue 0 goes first
+     * when the backend is deleted, and it is also the one that exists if
+     * creating any other queue failed.
+     */
+    if (!s->inhibit && nc->queue_index == 0 && s->xdp_flags &&
+        bpf_xdp_detach(s->ifindex, s->xdp_flags, NULL) != 0) {
+        error_report("af-xdp: unable to remove XDP program from '%s', "
+                     "ifindex: %d", s->ifname, s->ifindex);
+    }
+}
+
+static int af_xdp_umem_create(AFXDPState *s, int sock_fd, Error **errp)
+{
+    struct xsk_umem_config config = {
+        .fill_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .frame_size = XSK_UMEM__DEFAULT_FRAME_SIZE,
+        .frame_headroom = 0,
+    };
+    uint64_t n_descs;
+    uint64_t size;
+    uint64_t i;
+    int ret;
+
+    /* Enough frames for all four rings (rx, tx, cq, fq) to be full */
+    n_descs = (XSK_RING_PROD__DEFAULT_NUM_DESCS
+               + XSK_RING_CONS__DEFAULT_NUM_DESCS) * 2;
+    size = n_descs * XSK_UMEM__DEFAULT_FRAME_SIZE;
+
+    s->buffer = qemu_memalign(qemu_real_host_page_size(), size);
+    memset(s->buffer, 0, size);
+
+    if (sock_fd < 0) {
+        ret = xsk_umem__create(&s->umem, s->buffer, size,
+                               &s->fq, &s->cq, &config);
+    } else {
+        ret = xsk_umem__create_with_fd(&s->umem, sock_fd, s->buffer, size,
+                                       &s->fq, &s->cq, &config);
+    }
+
+    if (ret) {
+        qemu_vfree(s->buffer);
+        s->buffer = NULL;
+        error_setg_errno(errp, -ret,
+                         "failed to create umem for %s queue_index: %d",
+                         s->ifname, s->nc.queue_index);
+        return -1;
+    }
+
+    s->pool = g_new(uint64_t, n_descs);
+    /* Fill the pool in reverse order, because it is used as a LIFO */
+    for (i = 0; i < n_descs; i++) {
+        s->pool[i] = (n_descs - 1 - i) * XSK_UMEM__DEFAULT_FRAME_SIZE;
+    }
+    s->n_pool = n_descs;
+
+    af_xdp_fq_refill(s, XSK_RING_PROD__DEFAULT_NUM_DESCS);
+
+    return 0;
+}
+
+static int af_xdp_socket_create(AFXDPState *s,
+                                const NetdevAFXDPOptions *opts, Error **errp)
+{
+    struct xsk_socket_config cfg = {
+        .rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .tx_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .libxdp_flags = 0,
+        .bind_flags = XDP_USE_NEED_WAKEUP,
+        .xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST,
+    };
+    int queue_id, ret;
+
+    s->inhibit = opts->has_inhibit && opts->inhibit;
+    if (s->inhibit) {
+        cfg.libxdp_flags |= XSK_LIBXDP_FLAGS__INHIBIT_PROG_LOAD;
+    }
+
+    if (opts->has_force_copy && opts->force_copy) {
+        cfg.bind_flags |= XDP_COPY;
+    }
+
+    queue_id = s->nc.queue_index;
+    if (opts->has_start_queue) {
+        queue_id += opts->start_queue;
+    }
+
+    if (opts->has_mode) {
+        cfg.xdp_flags |= opts->mode == AFXDP_MODE_NATIVE ?
+                         XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+        ret = xsk_socket__create(&s->xsk, s->ifname, queue_id,
+                                 s->umem, &s->rx, &s->tx, &cfg);
+    } else {
+        /* Try native mode first, fall back to skb mode */
+        cfg.xdp_flags |= XDP_FLAGS_DRV_MODE;
+        ret = xsk_socket__create(&s->xsk, s->ifname, queue_id,
+                                 s->umem, &s->rx, &s->tx, &cfg);
+        if (ret) {
+            cfg.xdp_flags &= ~XDP_FLAGS_DRV_MODE;
+            cfg.xdp_flags |= XDP_FLAGS_SKB_MODE;
+            ret = xsk_socket__create(&s->xsk, s->ifname, queue_id,
+                                     s->umem, &s->rx, &s->tx, &cfg);
+        }
+    }
+
+    if (ret) {
+        error_setg_errno(errp, -ret,
+                         "failed to create AF_XDP socket for %s queue_id: %d",
+                         s->ifname, queue_id);
+        return -1;
+    }
+
+    s->xdp_flags = cfg.xdp_flags;
+
+    return 0;
+}
+
+/*
+ * Let the kernel process the device queue from the socket's poll() and
+ * recvmsg()/sendmsg() calls, instead of waiting for interrupts.
+ */
+static int af_xdp_busy_poll_setup(AFXDPState *s, uint32_t budget,
+                                  Error **errp)
+{
+#ifdef SO_PREFER_BUSY_POLL
+    int fd = xsk_socket__fd(s->xsk);
+    int prefer = 1;
+    int usecs = AF_XDP_BUSY_POLL_USECS;
+    int val = budget;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+                   &prefer, sizeof(prefer)) ||
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) ||
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &val, sizeof(val))) {
+        error_setg_errno(errp, errno,
+                         "failed to enable busy polling for %s queue_index: %d",
+                         s->ifname, s->nc.queue_index);
+        return -1;
+    }
+    return 0;
+#else
+    error_setg(errp, "busy polling is not supported by the host headers");
+    return -1;
+#endif
+}
+
+static NetClientInfo net_af_xdp_info = {
+    .type = NET_CLIENT_DRIVER_AF_XDP,
+    .size = sizeof(AFXDPState),
+    .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
+    .receive_batch = af_xdp_receive_batch,
+    .poll = af_xdp_poll,
+    .cleanup = af_xdp_cleanup,
+};
+
+static int *parse_socket_fds(const char *sock_fds_str,
+                             int64_t n_expected, Error **errp)
+{
+    gchar **substrings = g_strsplit(sock_fds_str, ":", -1);
+    int64_t i, n_sock_fds = g_strv_length(substrings);
+    int *sock_fds = NULL;
+
+    if (n_sock_fds != n_expected) {
+        error_setg(errp, "expected %" PRIi64 " socket fds, got %" PRIi64,
+                   n_expected, n_sock_fds);
+        goto exit;
+    }
+
+    sock_fds = g_new(int, n_sock_fds);
+
+    for (i = 0; i < n_sock_fds; i++) {
+        sock_fds[i] = monitor_fd_param(monitor_cur(), substrings[i], errp);
+        if (sock_fds[i] < 0) {
+            g_free(sock_fds);
+            sock_fds = NULL;
+            goto exit;
+        }
+    }
+
+exit:
+    g_strfreev(substrings);
+    return sock_fds;
+}
+
+/*
+ * The exported init function.
+ *
+ * ... -netdev af-xdp,ifname="..."
+ */
+int net_init_af_xdp(const Netdev *netdev,
+                    const char *name, NetClientState *peer, Error **errp)
+{
+    const NetdevAFXDPOptions *opts = &netdev->u.af_xdp;
+    NetClientState *nc, *nc0 = NULL;
+    unsigned int ifindex;
+    uint32_t prog_id = 0;
+    g_autofree int *sock_fds = NULL;
+    int64_t i, queues;
+    AFXDPState *s;
+
+    ifindex = if_nametoindex(opts->ifname);
+    if (!ifindex) {
+        error_setg_errno(errp, errno, "failed to get ifindex for '%s'",
+                         opts->ifname);
+        return -1;
+    }
+
+    queues = opts->has_queues ? opts->queues : 1;
+    if (queues < 1) {
+        error_setg(errp, "invalid number of queues (%" PRIi64 ") for '%s'",
+                   queues, opts->ifname);
+        return -1;
+    }
+
+    if (opts->has_start_queue && opts->start_queue < 0) {
+        error_setg(errp, "invalid start queue (%" PRIi64 ") for '%s'",
+                   opts->start_queue, opts->ifname);
+        return -1;
+    }
+
+    if ((opts->has_inhibit && opts->inhibit) != !!opts->sock_fds) {
+        error_setg(errp, "'inhibit=on' requires 'sock-fds' and vice versa");
+        return -1;
+    }
+
+    if (opts->sock_fds) {
+        sock_fds = parse_socket_fds(opts->sock_fds, queues, errp);
+        if (!sock_fds) {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < queues; i++) {
+        nc = qemu_new_net_client(&net_af_xdp_info, peer, "af-xdp", name);
+        qemu_set_info_str(nc, "af-xdp%" PRIi64 " to %s", i, opts->ifname);
+        nc->queue_index = i;
+
+        if (!nc0) {
+            nc0 = nc;
+        }
+
+        s = DO_UPCAST(AFXDPState, nc, nc);
+
+        pstrcpy(s->ifname, sizeof(s->ifname), opts->ifname);
+        s->ifindex = ifindex;
+
+        if (af_xdp_umem_create(s, sock_fds ? sock_fds[i] : -1, errp) ||
+            af_xdp_socket_create(s, opts, errp)) {
+            goto err;
+        }
+
+        if (opts->has_busy_poll_budget && opts->busy_poll_budget &&
+            af_xdp_busy_poll_setup(s, opts->busy_poll_budget, errp)) {
+            goto err;
+        }
+
+        /* Initially only poll for reads */
+        af_xdp_read_poll(s, true);
+    }
+
+    s = DO_UPCAST(AFXDPState, nc, nc0);
+    if (bpf_xdp_query_id(s->ifindex, s->xdp_flags, &prog_id) || !prog_id) {
+        error_setg_errno(errp, errno,
+                         "no XDP program loaded on '%s', ifindex: %d",
+                         s->ifname, s->ifindex);
+        goto err;
+    }
+
+    return 0;
+
+err:
+    qemu_del_net_client(nc0);
+
+    return -1;
+}
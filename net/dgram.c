@@ -100,6 +100,45 @@ static ssize_t net_dgram_receive(NetClientState *nc,
     return ret;
 }
 
+#ifdef CONFIG_LINUX
+#define NET_DGRAM_BATCH_MAX 64
+
+static int net_dgram_receive_batch(NetClientState *nc,
+                                   const NetBatchPacket *pkts, int count)
+{
+    NetDgramState *s = DO_UPCAST(NetDgramState, nc, nc);
+    struct mmsghdr msgs[NET_DGRAM_BATCH_MAX];
+    int sent = 0;
+
+    while (sent < count) {
+        int n = MIN(count - sent, NET_DGRAM_BATCH_MAX);
+        int i, ret;
+
+        memset(msgs, 0, n * sizeof(msgs[0]));
+        for (i = 0; i < n; i++) {
+            /* Like send() in net_dgram_receive() for a connected socket */
+            if (s->dest_addr) {
+                msgs[i].msg_hdr.msg_name = s->dest_addr;
+                msgs[i].msg_hdr.msg_namelen = s->dest_len;
+            }
+            msgs[i].msg_hdr.msg_iov = (struct iovec *)pkts[sent + i].iov;
+            msgs[i].msg_hdr.msg_iovlen = pkts[sent + i].iovcnt;
+        }
+
+        /* Errors are reported when the caller retries the packet */
+        ret = RETRY_ON_EINTR(sendmmsg(s->fd, msgs, n, 0));
+        if (ret <= 0) {
+            break;
+        }
+        sent += ret;
+        if (ret < n) {
+            break;
+        }
+    }
+    return sent;
+}
+#endif
+
 static void net_dgram_send_completed(NetClientState *nc, ssize_t len)
 {
     NetDgramState *s = DO_UPCAST(NetDgramState, nc, nc);
@@ -253,6 +292,9 @@ static NetClientInfo net_dgram_socket_info = {
     .type = NET_CLIENT_DRIVER_DGRAM,
     .size = sizeof(NetDgramState),
     .receive = net_dgram_receive,
+#ifdef CONFIG_LINUX
+    .receive_batch = net_dgram_receive_batch,
+#endif
     .cleanup = net_dgram_cleanup,
 };
 
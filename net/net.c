@@ -642,6 +642,41 @@ static ssize_t filter_receive(NetClientState *nc,
     return filter_receive_iov(nc, direction, sender, flags, &iov, 1, sent_cb);
 }
 
+static void qemu_receive_burst_begin(NetClientState *nc)
+{
+    if (nc->info->receive_burst_begin) {
+        nc->info->receive_burst_begin(nc);
+    }
+}
+
+static void qemu_receive_burst_end(NetClientState *nc)
+{
+    if (nc->info->receive_burst_end) {
+        nc->info->receive_burst_end(nc);
+    }
+}
+
+/*
+ * Packets that are sent between qemu_send_burst_begin() and
+ * qemu_send_burst_end() may be held back by the peer and handed to the guest
+ * all at once at the end of the burst, e.g. with a single interrupt.  The
+ * calls nest, and every call to qemu_send_burst_begin() must be paired with
+ * a call to qemu_send_burst_end() before returning to the main loop.
+ */
+void qemu_send_burst_begin(NetClientState *nc)
+{
+    if (nc->peer) {
+        qemu_receive_burst_begin(nc->peer);
+    }
+}
+
+void qemu_send_burst_end(NetClientState *nc)
+{
+    if (nc->peer) {
+        qemu_receive_burst_end(nc->peer);
+    }
+}
+
 void qemu_purge_queued_packets(NetClientState *nc)
 {
     if (!nc->peer) {
@@ -653,6 +688,8 @@ void qemu_purge_queued_packets(NetClientState *nc)
 
 void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge)
 {
+    bool flushed;
+
     nc->receive_disabled = 0;
 
     if (nc->peer && nc->peer->info->type == NET_CLIENT_DRIVER_HUBPORT) {
@@ -660,7 +697,11 @@ void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge)
             qemu_notify_event();
         }
     }
-    if (qemu_net_queue_flush(nc->incoming_queue)) {
+    qemu_receive_burst_begin(nc);
+    flushed = qemu_net_queue_flush(nc->incoming_queue);
+    qemu_receive_burst_end(nc);
+
+    if (flushed) {
         /* We emptied the queue successfully, signal to the IO thread to repoll
          * the file descriptor (for tap, for example).
          */
@@ -853,6 +894,41 @@ qemu_sendv_packet(NetClientState *nc, const struct iovec *iov, int iovcnt)
     return qemu_sendv_packet_async(nc, iov, iovcnt, NULL);
 }
 
+/*
+ * Hand several packets to the peer in one go, if it supports that and no
+ * filter has to see the packets on their way.  The sender must not have
+ * packets waiting in the peer's incoming queue, or they would be overtaken.
+ *
+ * Returns the number of leading packets that have been transmitted.  The
+ * caller sends the remaining ones with qemu_sendv_packet_async(), which
+ * takes care of queuing and error reporting.
+ */
+int qemu_sendv_packet_batch(NetClientState *sender, const NetBatchPacket *pkts,
+                            int count)
+{
+    NetClientState *peer = sender->peer;
+    int i;
+
+    if (sender->link_down || !peer || peer->link_down ||
+        !peer->info->receive_batch ||
+        !QTAILQ_EMPTY(&sender->filters) || !QTAILQ_EMPTY(&peer->filters) ||
+        !qemu_can_send_packet(sender)) {
+        return 0;
+    }
+
+    /* Oversized packets are dropped by qemu_sendv_packet_async() */
+    for (i = 0; i < count; i++) {
+        if (iov_size(pkts[i].iov, pkts[i].iovcnt) > NET_BUFSIZE) {
+            break;
+        }
+    }
+    if (!i) {
+        return 0;
+    }
+
+    return peer->info->receive_batch(peer, pkts, i);
+}
+
 NetClientState *qemu_find_netdev(const char *id)
 {
     NetClientState *nc;
@@ -1064,6 +1140,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
 #endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1168,6 +1247,9 @@ void show_netdevs(void)
 #ifdef CONFIG_NETMAP
         "netmap",
 #endif
+#ifdef CONFIG_AF_XDP
+        "af-xdp",
+#endif
 #ifdef CONFIG_POSIX
         "vhost-user",
 #endif
@@ -185,6 +185,9 @@ static void tap_send(void *opaque)
     int size;
     int packets = 0;
 
+    /* Let the peer make all packets of this wakeup visible at once */
+    qemu_send_burst_begin(&s->nc);
+
     while (true) {
         uint8_t *buf = s->buf;
         uint8_t min_pkt[ETH_ZLEN];
@@ -226,6 +229,8 @@ static void tap_send(void *opaque)
             break;
         }
     }
+
+    qemu_send_burst_end(&s->nc);
 }
 
 static bool tap_has_ufo(NetClientState *nc)
@@ -1273,6 +1273,31 @@ static int is_allocated_sectors_min(const uint8_t *buf, int n, int *pnum,
     return 1;
 }
 
+/*
+ * Like is_allocated_sectors, but for targets that are written in whole
+ * clusters: returns whether the first cluster of the buffer contains data
+ * and sets *pnum to the number of sectors of the following clusters in the
+ * same state. Only the last cluster may be shorter than 'cluster_sectors'.
+ */
+static int is_allocated_clusters(const uint8_t *buf, int n, int *pnum,
+                                 int cluster_sectors)
+{
+    bool is_zero;
+    int i;
+
+    is_zero = buffer_is_zero(buf, MIN(n, cluster_sectors) * BDRV_SECTOR_SIZE);
+    for (i = cluster_sectors; i < n; i += cluster_sectors) {
+        int len = MIN(n - i, cluster_sectors);
+
+        if (buffer_is_zero(buf + i * BDRV_SECTOR_SIZE,
+                           len * BDRV_SECTOR_SIZE) != is_zero) {
+            break;
+        }
+    }
+    *pnum = MIN(i, n);
+    return !is_zero;
+}
+
 /*
  * Compares two buffers sector by sector. Returns 0 if the first
  * sector of each buffer matches, non-zero otherwise.
@@ -1661,6 +1686,15 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/* Limit for the block status extents remembered between the two passes */
+#define MAX_STATUS_CACHE_ENTRIES (1024 * 1024)
+
+typedef struct ImgConvertStatusEntry {
+    int64_t sector_num;
+    int64_t sector_next_status;
+    enum ImgConvertBlockStatus status;
+} ImgConvertStatusEntry;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1673,6 +1707,9 @@ typedef struct ImgConvertState {
     int64_t wr_offs;
     enum ImgConvertBlockStatus status;
     int64_t sector_next_status;
+    GArray *status_cache;
+    guint status_cache_pos;
+    bool status_cache_replay;
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
@@ -1707,6 +1744,49 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
+/*
+ * The copy pass queries block status at the same sectors as the pass that
+ * counts allocated sectors before it, so the first pass records its results
+ * and the copy replays them instead of asking the source again.
+ */
+static void convert_status_cache_add(ImgConvertState *s, int64_t sector_num)
+{
+    ImgConvertStatusEntry e = {
+        .sector_num         = sector_num,
+        .sector_next_status = s->sector_next_status,
+        .status             = s->status,
+    };
+
+    if (s->status_cache && !s->status_cache_replay &&
+        s->status_cache->len < MAX_STATUS_CACHE_ENTRIES) {
+        g_array_append_val(s->status_cache, e);
+    }
+}
+
+static bool convert_status_cache_lookup(ImgConvertState *s, int64_t sector_num)
+{
+    ImgConvertStatusEntry *e;
+
+    if (!s->status_cache || !s->status_cache_replay) {
+        return false;
+    }
+
+    while (s->status_cache_pos < s->status_cache->len) {
+        e = &g_array_index(s->status_cache, ImgConvertStatusEntry,
+                           s->status_cache_pos);
+        if (e->sector_num > sector_num) {
+            break;
+        }
+        s->status_cache_pos++;
+        if (e->sector_num == sector_num) {
+            s->status = e->status;
+            s->sector_next_status = e->sector_next_status;
+            return true;
+        }
+    }
+    return false;
+}
+
 static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 {
     int64_t src_cur_offset;
@@ -1728,7 +1808,8 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
     }
 
-    if (s->sector_next_status <= sector_num) {
+    if (s->sector_next_status <= sector_num &&
+        !convert_status_cache_lookup(s, sector_num)) {
         uint64_t offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
         int64_t count;
         int tail;
@@ -1791,6 +1872,7 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
 
         s->sector_next_status = sector_num + n;
+        convert_status_cache_add(s, sector_num);
     }
 
     n = MIN(n, s->sector_next_status - sector_num);
@@ -1890,14 +1972,14 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * is real non-zero data, we must write it. Otherwise we can treat
              * it as zero sectors.
              * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
+             * case we can only save the write for completely zeroed
+             * clusters. */
             if (!s->min_sparse ||
                 (!s->compressed &&
                  is_allocated_sectors_min(buf, n, &n, s->min_sparse,
                                           sector_num, s->alignment)) ||
                 (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                 is_allocated_clusters(buf, n, &n, s->cluster_sectors)))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
@@ -2096,19 +2178,32 @@ static int convert_do_copy(ImgConvertState *s)
         s->has_zero_init = bdrv_has_zero_init(blk_bs(s->target));
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /*
+     * Allocate buffer for copied data. For compressed images, only whole
+     * clusters can be copied. Drivers that compress multi-cluster requests
+     * in parallel get as many clusters as fit in the buffer, the others only
+     * one cluster at a time.
+     */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
+        if (blk_bs(s->target)->drv->bdrv_co_pwritev_compressed_part) {
+            s->buf_sectors = QEMU_ALIGN_DOWN(s->buf_sectors,
+                                             s->cluster_sectors);
+        } else {
+            s->buf_sectors = s->cluster_sectors;
+        }
     }
 
+    s->status_cache = g_array_new(false, false,
+                                  sizeof(ImgConvertStatusEntry));
     while (sector_num < s->total_sectors) {
         n = convert_iteration_sectors(s, sector_num);
         if (n < 0) {
+            g_array_free(s->status_cache, true);
+            s->status_cache = NULL;
             return n;
         }
         if (s->status == BLK_DATA || (!s->min_sparse && s->status == BLK_ZERO))
@@ -2120,6 +2215,7 @@ static int convert_do_copy(ImgConvertState *s)
 
     /* Do the copy */
     s->sector_next_status = 0;
+    s->status_cache_replay = true;
     s->ret = -EINPROGRESS;
 
     qemu_co_mutex_init(&s->lock);
@@ -2133,6 +2229,9 @@ static int convert_do_copy(ImgConvertState *s)
         main_loop_wait(false);
     }
 
+    g_array_free(s->status_cache, true);
+    s->status_cache = NULL;
+
     if (s->compressed && !s->ret) {
         /* signal EOF to align */
         ret = blk_pwrite_compressed(s->target, 0, 0, NULL);
@@ -12,10 +12,13 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qapi/error.h"
 #include "../migration/xbzrle.h"
+#include "../migration/page_cache.h"
 
-#if defined(CONFIG_AVX512BW_OPT)
 #define XBZRLE_PAGE_SIZE 4096
+
+#if defined(CONFIG_AVX512BW_OPT)
 static bool is_cpu_support_avx512bw;
 #include "qemu/cpuid.h"
 static void __attribute__((constructor)) init_cpu_flag(void)
@@ -449,6 +452,105 @@ static void test_encode_decode_random_avx512(void)
 }
 #endif
 
+static void test_decode_sparse(void)
+{
+    uint8_t *old = g_malloc0(XBZRLE_PAGE_SIZE);
+    uint8_t *new = g_malloc0(XBZRLE_PAGE_SIZE);
+    uint8_t *compressed = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *out = g_malloc0(XBZRLE_PAGE_SIZE);
+    int64_t t_start, t_end;
+    int i, dlen, rc = 0;
+
+    /* a few bytes dirtied in every cache line, the typical xbzrle page */
+    for (i = 0; i < XBZRLE_PAGE_SIZE; i += 64) {
+        new[i] = i + 1;
+        new[i + 1] = i + 2;
+    }
+    dlen = xbzrle_encode_buffer(old, new, XBZRLE_PAGE_SIZE, compressed,
+                                XBZRLE_PAGE_SIZE);
+    /* a one byte zrun, a one byte nzrun and two bytes of data per line */
+    g_assert_cmpint(dlen, ==, XBZRLE_PAGE_SIZE / 64 * 4);
+
+    /* the first decode starts from the old page, check it on its own */
+    rc = xbzrle_decode_buffer(compressed, dlen, out, XBZRLE_PAGE_SIZE);
+    g_assert_cmpint(rc, ==, XBZRLE_PAGE_SIZE - 64 + 2);
+    g_assert(memcmp(out, new, XBZRLE_PAGE_SIZE) == 0);
+
+    t_start = g_get_monotonic_time();
+    for (i = 0; i < 100000; i++) {
+        memcpy(out, old, XBZRLE_PAGE_SIZE);
+        rc = xbzrle_decode_buffer(compressed, dlen, out, XBZRLE_PAGE_SIZE);
+    }
+    t_end = g_get_monotonic_time();
+    g_assert_cmpint(rc, ==, XBZRLE_PAGE_SIZE - 64 + 2);
+    g_assert(memcmp(out, new, XBZRLE_PAGE_SIZE) == 0);
+
+    printf("Sparse decode test:\n");
+    printf("xbzrle_decode time is %f ms\n", (t_end - t_start) / 1000.0);
+
+    g_free(old);
+    g_free(new);
+    g_free(compressed);
+    g_free(out);
+}
+
+static void test_cache_hit_rate(void)
+{
+    const size_t cache_pages = 256;
+    uint8_t *page = g_malloc0(XBZRLE_PAGE_SIZE);
+    uint64_t hit = 0, miss = 0, hot_eviction = 0, eviction = 0;
+    uint64_t age, addr;
+    PageCache *cache;
+    int i, ret;
+
+    cache = cache_init(cache_pages * XBZRLE_PAGE_SIZE, XBZRLE_PAGE_SIZE,
+                       &error_abort);
+
+    /*
+     * Half the cache worth of hot pages, in pairs that collide in the
+     * low address bits, plus a stream of cold pages each generation.
+     */
+    for (age = 1; age <= 64; age++) {
+        for (i = 0; i < cache_pages / 2; i++) {
+            addr = ((i / 2) + (i % 2) * cache_pages) * XBZRLE_PAGE_SIZE;
+            if (cache_is_cached(cache, addr, age)) {
+                hit++;
+                continue;
+            }
+            miss++;
+            ret = cache_insert(cache, addr, page, age);
+            if (ret == 1) {
+                hot_eviction++;
+            }
+        }
+        for (i = 0; i < cache_pages; i++) {
+            addr = ((age + 1) * cache_pages + i) * XBZRLE_PAGE_SIZE;
+            ret = cache_insert(cache, addr, page, age);
+            if (ret == 1) {
+                eviction++;
+            }
+        }
+    }
+
+    printf("Page cache test:\n");
+    printf("hot set hit rate is %f%%, %" PRIu64 " evictions\n",
+           100.0 * hit / (hit + miss), eviction);
+
+    /*
+     * With four ways per set, the two hot pages of a set are never the
+     * least recently used entries, so they miss only in the first
+     * generation.  The cold pages share the two remaining ways and cannot
+     * replace an entry younger than two generations, so each set evicts at
+     * most two of them every other generation.
+     */
+    g_assert_cmpint(miss, ==, cache_pages / 2);
+    g_assert_cmpint(hot_eviction, ==, 0);
+    g_assert_cmpint(eviction, <=, 64 * cache_pages / 4);
+
+    cache_fini(cache);
+    g_free(page);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -465,5 +567,7 @@ int main(int argc, char **argv)
         g_test_add_func("/xbzrle/encode_decode_random", test_encode_decode_random_avx512);
     }
     #endif
+    g_test_add_func("/xbzrle/decode_sparse", test_decode_sparse);
+    g_test_add_func("/xbzrle/cache_hit_rate", test_cache_hit_rate);
     return g_test_run();
 }
@@ -577,6 +577,7 @@ typedef struct {
     /* Postcopy specific fields */
     void *postcopy_data;
     bool postcopy_preempt;
+    bool postcopy_multifd;
 } MigrateCommon;
 
 static int test_migrate_start(QTestState **from, QTestState **to,
@@ -1116,6 +1117,11 @@ static int migrate_postcopy_prepare(QTestState **from_ptr,
         migrate_set_capability(to, "postcopy-preempt", true);
     }
 
+    if (args->postcopy_multifd) {
+        migrate_set_capability(from, "postcopy-multifd", true);
+        migrate_set_capability(to, "postcopy-multifd", true);
+    }
+
     migrate_ensure_non_converge(from);
 
     /* Wait for the first serial output from the source */
@@ -1178,6 +1184,28 @@ static void test_postcopy_preempt(void)
     test_postcopy_common(&args);
 }
 
+static void *
+test_migrate_postcopy_multifd_start(QTestState *from, QTestState *to)
+{
+    migrate_set_parameter_int(from, "multifd-channels", 4);
+    migrate_set_parameter_int(to, "multifd-channels", 4);
+
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
+
+    return NULL;
+}
+
+static void test_postcopy_multifd(void)
+{
+    MigrateCommon args = {
+        .postcopy_multifd = true,
+        .start_hook = test_migrate_postcopy_multifd_start,
+    };
+
+    test_postcopy_common(&args);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_postcopy_tls_psk(void)
 {
@@ -1387,6 +1415,162 @@ static void test_precopy_common(MigrateCommon *args)
     test_migrate_end(from, to, args->result == MIG_TEST_SUCCEED);
 }
 
+#define FILE_TEST_FILENAME "migfile"
+
+static void test_file_common(MigrateCommon *args)
+{
+    QTestState *from, *to;
+    void *data_hook = NULL;
+    QDict *rsp;
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+
+    if (test_migrate_start(&from, &to, "defer", &args->start)) {
+        return;
+    }
+
+    migrate_ensure_converge(from);
+
+    if (args->start_hook) {
+        data_hook = args->start_hook(from, to);
+    }
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri, "{}");
+    wait_for_migration_complete(from);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    /* The file is complete, load it on the destination */
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': %s }}", uri);
+    qobject_unref(rsp);
+
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+
+    if (args->finish_hook) {
+        args->finish_hook(from, to, data_hook);
+    }
+
+    test_migrate_end(from, to, true);
+    cleanup(FILE_TEST_FILENAME);
+}
+
+static void *
+test_migrate_file_mapped_ram_start(QTestState *from, QTestState *to)
+{
+    migrate_set_capability(from, "mapped-ram", true);
+    migrate_set_capability(to, "mapped-ram", true);
+
+    return NULL;
+}
+
+static void test_precopy_file_mapped_ram(void)
+{
+    MigrateCommon args = {
+        .start_hook = test_migrate_file_mapped_ram_start,
+    };
+
+    test_file_common(&args);
+}
+
+static void *
+test_migrate_multifd_file_mapped_ram_start(QTestState *from, QTestState *to)
+{
+    migrate_set_parameter_int(from, "multifd-channels", 4);
+    migrate_set_parameter_int(to, "multifd-channels", 4);
+
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
+
+    return test_migrate_file_mapped_ram_start(from, to);
+}
+
+static void test_multifd_file_mapped_ram(void)
+{
+    MigrateCommon args = {
+        .start_hook = test_migrate_multifd_file_mapped_ram_start,
+    };
+
+    test_file_common(&args);
+}
+
+/*
+ * Migrate the source once to a file, so that it learns how long saving
+ * the device state takes, then again to the destination.  That second
+ * time the device state must be left out of the downtime-limit budget.
+ */
+static void test_precopy_switchover_estimate(void)
+{
+    QTestState *from, *to;
+    MigrateStart args = {};
+    g_autofree char *file_uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                                FILE_TEST_FILENAME);
+    g_autofree char *uri = NULL;
+    int64_t device_downtime;
+    QDict *rsp;
+
+    if (test_migrate_start(&from, &to, "tcp:127.0.0.1:0", &args)) {
+        return;
+    }
+
+    wait_for_serial("src_serial");
+
+    /* Nothing has been measured yet */
+    migrate_ensure_converge(from);
+    migrate_qmp(from, file_uri, "{}");
+    wait_for_migration_complete(from);
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    g_assert_cmpint(read_migrate_property_int(from, "device-downtime"), ==, 0);
+
+    rsp = wait_command(from, "{ 'execute': 'cont' }");
+    qobject_unref(rsp);
+    qtest_qmp_eventwait(from, "RESUME");
+    got_stop = false;
+
+    migrate_ensure_non_converge(from);
+    uri = migrate_get_socket_address(to, "socket-address");
+    migrate_qmp(from, uri, "{}");
+    wait_for_migration_pass(from);
+
+    device_downtime = read_migrate_property_int(from, "device-downtime");
+    g_assert_cmpint(device_downtime, >=, 1);
+    g_assert_cmpint(read_migrate_property_int(from, "predicted-downtime"),
+                    >=, device_downtime);
+
+    /*
+     * With the whole downtime-limit taken by the device state, there is no
+     * budget left for RAM and a running guest must not switch over, however
+     * fast the link.
+     */
+    migrate_set_parameter_int(from, "max-bandwidth", 1 * 1000 * 1000 * 1000);
+    migrate_set_parameter_int(from, "downtime-limit", device_downtime);
+    wait_for_migration_pass(from);
+    wait_for_migration_pass(from);
+    g_assert_false(got_stop);
+    rsp = migrate_query(from);
+    g_assert_cmpstr(qdict_get_str(rsp, "status"), ==, "active");
+    qobject_unref(rsp);
+
+    migrate_ensure_converge(from);
+    wait_for_migration_complete(from);
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+    cleanup(FILE_TEST_FILENAME);
+}
+
 static void test_precopy_unix_plain(void)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -1524,6 +1708,40 @@ static void test_precopy_unix_xbzrle(void)
     test_precopy_common(&args);
 }
 
+static void test_migrate_bitmap_sync_finish(QTestState *from,
+                                            QTestState *to,
+                                            void *opaque)
+{
+    int64_t sync_time = read_ram_property_int(from, "dirty-sync-time");
+
+    g_assert_cmpint(read_ram_property_int(from, "dirty-sync-count"), >=, 3);
+    g_assert_cmpint(read_ram_property_int(from, "dirty-sync-time-max"), >=,
+                    sync_time);
+}
+
+/*
+ * The RAMBlocks of the machine are merged into the migration bitmap by the
+ * migration thread and the helper threads in parallel, while the guest
+ * keeps dirtying memory.  The destination checks that no page was missed.
+ */
+static void test_precopy_unix_bitmap_sync_threads(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .start = {
+            .opts_source = "-global migration.x-bitmap-sync-threads=4",
+        },
+        .connect_uri = uri,
+        .listen_uri = uri,
+
+        .finish_hook = test_migrate_bitmap_sync_finish,
+
+        .iterations = 3,
+    };
+
+    test_precopy_common(&args);
+}
+
 static void test_precopy_tcp_plain(void)
 {
     MigrateCommon args = {
@@ -1895,6 +2113,28 @@ test_migrate_precopy_tcp_multifd_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_zero_page_start(QTestState *from,
+                                                 QTestState *to)
+{
+    migrate_set_capability(from, "multifd-zero-page", true);
+    migrate_set_capability(to, "multifd-zero-page", true);
+
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+}
+
+static void *
+test_migrate_precopy_tcp_multifd_async_device_state_start(QTestState *from,
+                                                          QTestState *to)
+{
+    test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+
+    /* Needs multifd to be enabled first */
+    migrate_set_capability(from, "async-device-state", true);
+
+    return NULL;
+}
+
 static void *
 test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
                                             QTestState *to)
@@ -1911,6 +2151,17 @@ test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
 }
 #endif /* CONFIG_ZSTD */
 
+#ifdef CONFIG_LZ4
+static void *
+test_migrate_precopy_tcp_multifd_lz4_start(QTestState *from,
+                                           QTestState *to)
+{
+    migrate_set_parameter_int(from, "multifd-lz4-acceleration", 4);
+
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "lz4");
+}
+#endif /* CONFIG_LZ4 */
+
 static void test_multifd_tcp_none(void)
 {
     MigrateCommon args = {
@@ -1920,6 +2171,42 @@ static void test_multifd_tcp_none(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_zero_page(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_zero_page_start,
+    };
+    test_precopy_common(&args);
+}
+
+/*
+ * How much of the device state is saved while RAM is still being sent
+ * depends on timing, so only check that the counter is reported
+ */
+static void
+test_migrate_precopy_tcp_multifd_async_device_state_finish(QTestState *from,
+                                                           QTestState *to,
+                                                           void *opaque)
+{
+    QDict *rsp_return = migrate_query_not_failed(from);
+
+    g_assert(qdict_haskey(rsp_return, "device-state-overlap"));
+    g_assert_cmpint(qdict_get_int(rsp_return, "device-state-overlap"), >=, 0);
+    qobject_unref(rsp_return);
+}
+
+static void test_multifd_tcp_async_device_state(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_async_device_state_start,
+        .finish_hook =
+            test_migrate_precopy_tcp_multifd_async_device_state_finish,
+    };
+    test_precopy_common(&args);
+}
+
 static void test_multifd_tcp_zlib(void)
 {
     MigrateCommon args = {
@@ -1940,6 +2227,17 @@ static void test_multifd_tcp_zstd(void)
 }
 #endif
 
+#ifdef CONFIG_LZ4
+static void test_multifd_tcp_lz4(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_lz4_start,
+    };
+    test_precopy_common(&args);
+}
+#endif
+
 #ifdef CONFIG_GNUTLS
 static void *
 test_migrate_multifd_tcp_tls_psk_start_match(QTestState *from,
@@ -2187,6 +2485,69 @@ static void test_multifd_tcp_cancel(void)
     test_migrate_end(from, to2, true);
 }
 
+/*
+ * Check the per-channel statistics of the destination, and that the
+ * coalesced receive iovecs put every page where it belongs (which
+ * test_migrate_end() verifies on the guest memory).
+ */
+static void test_multifd_tcp_channel_stats(void)
+{
+    MigrateStart args = {};
+    QTestState *from, *to;
+    g_autofree char *uri = NULL;
+    uint64_t packets = 0, normal_pages = 0;
+    bool seen[16] = {};
+    const QListEntry *entry;
+    QDict *rsp;
+    QList *channels;
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    migrate_ensure_non_converge(from);
+    test_migrate_precopy_tcp_multifd_start(from, to);
+
+    wait_for_serial("src_serial");
+
+    uri = migrate_get_socket_address(to, "socket-address");
+    migrate_qmp(from, uri, "{}");
+    wait_for_migration_pass(from);
+
+    /* The channels are open until the migration completes */
+    rsp = migrate_query(to);
+    channels = qdict_get_qlist(rsp, "multifd-recv-channels");
+    g_assert(channels);
+    g_assert_cmpint(qlist_size(channels), ==, 16);
+    QLIST_FOREACH_ENTRY(channels, entry) {
+        QDict *stats = qobject_to(QDict, qlist_entry_obj(entry));
+        int64_t id = qdict_get_int(stats, "id");
+
+        g_assert_cmpint(id, <, 16);
+        g_assert_false(seen[id]);
+        seen[id] = true;
+
+        packets += qdict_get_int(stats, "packets");
+        normal_pages += qdict_get_int(stats, "normal-pages");
+        g_assert_cmpint(qdict_get_int(stats, "bytes"), >=,
+                        qdict_get_int(stats, "normal-pages") *
+                        TEST_MEM_PAGE_SIZE);
+    }
+    g_assert_cmpint(packets, >, 0);
+    g_assert_cmpint(normal_pages, >, 0);
+    qobject_unref(rsp);
+
+    migrate_ensure_converge(from);
+    wait_for_migration_complete(from);
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+}
+
 static void calc_dirty_rate(QTestState *who, uint64_t calc_time)
 {
     qobject_unref(qmp_command(who,
@@ -2434,6 +2795,105 @@ static void test_vcpu_dirty_limit(void)
     dirtylimit_stop_vm(vm);
 }
 
+static void migrate_set_capability_error(QTestState *who,
+                                         const char *capability,
+                                         const char *expected)
+{
+    QDict *rsp;
+
+    rsp = qtest_qmp(who,
+                    "{ 'execute': 'migrate-set-capabilities',"
+                    "'arguments': { "
+                    "'capabilities': [ { "
+                    "'capability': %s, 'state': true } ] } }",
+                    capability);
+    g_assert(qdict_haskey(rsp, "error"));
+    g_assert_true(g_str_has_prefix(qdict_get_str(qdict_get_qdict(rsp, "error"),
+                                                 "desc"), expected));
+    qobject_unref(rsp);
+}
+
+/* dirty-limit is refused together with auto-converge or without dirty ring */
+static void test_migrate_dirty_limit_caps(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateStart args = {
+        .hide_stderr = true,
+    };
+    QTestState *from, *to;
+
+    if (test_migrate_start(&from, &to, uri, &args)) {
+        return;
+    }
+
+    migrate_set_capability(from, "auto-converge", true);
+    migrate_set_capability_error(from, "dirty-limit",
+                                 "dirty-limit conflicts with auto-converge");
+    migrate_set_capability(from, "auto-converge", false);
+    migrate_set_capability_error(from, "dirty-limit",
+                                 "dirty-limit requires KVM");
+
+    test_migrate_end(from, to, false);
+}
+
+static bool dirty_limit_in_service(QTestState *who)
+{
+    QDict *rsp = query_vcpu_dirty_limit(who);
+    bool ret = !qlist_empty(qdict_get_qlist(rsp, "return"));
+
+    qobject_unref(rsp);
+    return ret;
+}
+
+static void test_migrate_dirty_limit(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateStart args = {
+        .use_dirty_ring = true,
+    };
+    QTestState *from, *to;
+    int max_try_count = 200;
+
+    if (test_migrate_start(&from, &to, uri, &args)) {
+        return;
+    }
+
+    migrate_set_capability(from, "dirty-limit", true);
+    migrate_set_parameter_int(from, "cpu-throttle-increment", 50);
+
+    /* The guest must be throttled before the migration can converge */
+    migrate_ensure_non_converge(from);
+
+    wait_for_serial("src_serial");
+
+    g_assert_false(dirty_limit_in_service(from));
+    migrate_qmp(from, uri, "{}");
+
+    /* Wait for the vCPUs to be limited */
+    while (!dirty_limit_in_service(from)) {
+        g_assert_cmpint(--max_try_count, >, 0);
+        g_assert_false(got_stop);
+        usleep(100 * 1000);
+    }
+
+    migrate_ensure_converge(from);
+    wait_for_migration_complete(from);
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+
+    /* The limit is lifted once the migration thread is done */
+    max_try_count = 200;
+    while (dirty_limit_in_service(from)) {
+        g_assert_cmpint(--max_try_count, >, 0);
+        usleep(100 * 1000);
+    }
+
+    test_migrate_end(from, to, true);
+}
+
 static bool kvm_dirty_ring_supported(void)
 {
 #if defined(__linux__) && defined(HOST_X86_64)
@@ -2501,6 +2961,8 @@ int main(int argc, char **argv)
         qtest_add_func("/migration/postcopy/recovery/plain",
                        test_postcopy_recovery);
         qtest_add_func("/migration/postcopy/preempt/plain", test_postcopy_preempt);
+        qtest_add_func("/migration/postcopy/multifd/plain",
+                       test_postcopy_multifd);
         qtest_add_func("/migration/postcopy/preempt/recovery/plain",
                        test_postcopy_preempt_recovery);
     }
@@ -2508,6 +2970,8 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix/plain", test_precopy_unix_plain);
     qtest_add_func("/migration/precopy/unix/xbzrle", test_precopy_unix_xbzrle);
+    qtest_add_func("/migration/precopy/unix/bitmap-sync-threads",
+                   test_precopy_unix_bitmap_sync_threads);
 #ifdef CONFIG_GNUTLS
     qtest_add_func("/migration/precopy/unix/tls/psk",
                    test_precopy_unix_tls_psk);
@@ -2535,6 +2999,8 @@ int main(int argc, char **argv)
 #endif /* CONFIG_GNUTLS */
 
     qtest_add_func("/migration/precopy/tcp/plain", test_precopy_tcp_plain);
+    qtest_add_func("/migration/precopy/tcp/switchover-estimate",
+                   test_precopy_switchover_estimate);
 #ifdef CONFIG_GNUTLS
     qtest_add_func("/migration/precopy/tcp/tls/psk/match",
                    test_precopy_tcp_tls_psk_match);
@@ -2570,8 +3036,18 @@ int main(int argc, char **argv)
                    test_validate_uuid_dst_not_set);
 
     qtest_add_func("/migration/auto_converge", test_migrate_auto_converge);
+    qtest_add_func("/migration/dirty_limit/caps",
+                   test_migrate_dirty_limit_caps);
     qtest_add_func("/migration/multifd/tcp/plain/none",
                    test_multifd_tcp_none);
+    qtest_add_func("/migration/multifd/tcp/plain/zero-page",
+                   test_multifd_tcp_zero_page);
+    qtest_add_func("/migration/multifd/tcp/plain/async-device-state",
+                   test_multifd_tcp_async_device_state);
+    qtest_add_func("/migration/precopy/file/mapped-ram",
+                   test_precopy_file_mapped_ram);
+    qtest_add_func("/migration/multifd/file/mapped-ram",
+                   test_multifd_file_mapped_ram);
     /*
      * This test is flaky and sometimes fails in CI and otherwise:
      * don't run unless user opts in via environment variable.
@@ -2580,12 +3056,18 @@ int main(int argc, char **argv)
         qtest_add_func("/migration/multifd/tcp/plain/cancel",
                        test_multifd_tcp_cancel);
     }
+    qtest_add_func("/migration/multifd/tcp/plain/channel-stats",
+                   test_multifd_tcp_channel_stats);
     qtest_add_func("/migration/multifd/tcp/plain/zlib",
                    test_multifd_tcp_zlib);
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/plain/zstd",
                    test_multifd_tcp_zstd);
 #endif
+#ifdef CONFIG_LZ4
+    qtest_add_func("/migration/multifd/tcp/plain/lz4",
+                   test_multifd_tcp_lz4);
+#endif
 #ifdef CONFIG_GNUTLS
     qtest_add_func("/migration/multifd/tcp/tls/psk/match",
                    test_multifd_tcp_tls_psk_match);
@@ -2610,6 +3092,8 @@ int main(int argc, char **argv)
                        test_precopy_unix_dirty_ring);
         qtest_add_func("/migration/vcpu_dirty_limit",
                        test_vcpu_dirty_limit);
+        qtest_add_func("/migration/dirty_limit",
+                       test_migrate_dirty_limit);
     }
 
     ret = g_test_run();
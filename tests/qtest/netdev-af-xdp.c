@@ -0,0 +1,70 @@
+/*
+ * QTest testcase for the option parsing of netdev af-xdp
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+
+/*
+ * Add an af-xdp netdev with the given options, which must fail before any
+ * AF_XDP socket is created, and check the start of the error message.
+ */
+static void check_netdev_add_error(QTestState *qts, const char *opts,
+                                   const char *expected)
+{
+    QDict *rsp;
+    const char *desc;
+
+    rsp = qtest_qmp(qts, "{ 'execute': 'netdev_add', 'arguments': {"
+                    " 'type': 'af-xdp', 'id': 'n0', %s } }", opts);
+    g_assert(qdict_haskey(rsp, "error"));
+    desc = qdict_get_str(qdict_get_qdict(rsp, "error"), "desc");
+    g_assert_true(g_str_has_prefix(desc, expected));
+    qobject_unref(rsp);
+}
+
+static void test_af_xdp_options(void)
+{
+    QTestState *qts = qtest_init("-nodefaults -M none");
+
+    check_netdev_add_error(qts, "'ifname': 'qtest-nonexistent0'",
+                           "failed to get ifindex for 'qtest-nonexistent0'");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'queues': 0",
+                           "invalid number of queues (0) for 'lo'");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'start-queue': -1",
+                           "invalid start queue (-1) for 'lo'");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'inhibit': true",
+                           "'inhibit=on' requires 'sock-fds'");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'sock-fds': '3'",
+                           "'inhibit=on' requires 'sock-fds'");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'queues': 1, 'inhibit': true,"
+                           " 'sock-fds': '3:4'",
+                           "expected 1 socket fds, got 2");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'mode': 'generic'",
+                           "Parameter 'mode' does not accept value");
+
+    qtest_quit(qts);
+}
+
+static void test_af_xdp_help(void)
+{
+    /* The backend is built in and listed with the others */
+    QTestState *qts = qtest_init("-nodefaults -M none");
+    g_autofree char *help = qtest_hmp(qts, "netdev_add help");
+
+    g_assert_nonnull(strstr(help, "af-xdp"));
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/netdev/af-xdp/options", test_af_xdp_options);
+    qtest_add_func("/netdev/af-xdp/help", test_af_xdp_help);
+
+    return g_test_run();
+}
@@ -722,6 +722,130 @@ static void pci_hotplug(void *obj, void *data, QGuestAllocator *t_alloc)
     qpci_unplug_acpi_device_test(qts, "drv1", PCI_SLOT_HP);
 }
 
+#define VQ_MAPPING_NUM_QUEUES 4
+
+/*
+ * Hotplug a device whose virtqueues are serviced by two IOThreads and
+ * access the disk through every virtqueue.
+ */
+static void iothread_vq_mapping(void *obj, void *data,
+                                QGuestAllocator *t_alloc)
+{
+    QVirtioPCIDevice *dev1 = obj;
+    QVirtioPCIDevice *pdev;
+    QVirtioDevice *dev;
+    QVirtQueue *vq[VQ_MAPPING_NUM_QUEUES];
+    QTestState *qts = dev1->pdev->bus->qts;
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint64_t features;
+    uint32_t free_head;
+    uint8_t status;
+    char *data_buf;
+    int i;
+
+    if (dev1->pdev->bus->not_hotpluggable) {
+        g_test_skip("pci bus does not support hotplug");
+        return;
+    }
+
+    qtest_qmp_device_add(qts, "virtio-blk-pci", "drv2",
+                         "{'addr': %s, 'drive': 'drive2', 'num-queues': %d,"
+                         " 'iothread-vq-mapping': ['iothread0', 'iothread1']}",
+                         stringify(PCI_SLOT_HP) ".0", VQ_MAPPING_NUM_QUEUES);
+
+    pdev = virtio_pci_new(dev1->pdev->bus, &(QPCIAddress) {
+                              .devfn = QPCI_DEVFN(PCI_SLOT_HP, 0)
+                          });
+    g_assert_nonnull(pdev);
+    dev = &pdev->vdev;
+    g_assert_cmpint(dev->device_type, ==, VIRTIO_ID_BLOCK);
+
+    qvirtio_pci_device_enable(pdev);
+    qvirtio_start_device(dev);
+
+    features = qvirtio_get_features(dev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    for (i = 0; i < VQ_MAPPING_NUM_QUEUES; i++) {
+        vq[i] = qvirtqueue_setup(dev, t_alloc, i);
+    }
+    qvirtio_set_driver_ok(dev);
+
+    /* Write one sector through each virtqueue */
+    for (i = 0; i < VQ_MAPPING_NUM_QUEUES; i++) {
+        req.type = VIRTIO_BLK_T_OUT;
+        req.ioprio = 1;
+        req.sector = i;
+        req.data = g_malloc0(512);
+        sprintf(req.data, "TEST%d", i);
+
+        req_addr = virtio_blk_request(t_alloc, dev, &req, 512);
+
+        g_free(req.data);
+
+        free_head = qvirtqueue_add(qts, vq[i], req_addr, 16, false, true);
+        qvirtqueue_add(qts, vq[i], req_addr + 16, 512, false, true);
+        qvirtqueue_add(qts, vq[i], req_addr + 528, 1, true, false);
+        qvirtqueue_kick(qts, dev, vq[i], free_head);
+
+        qvirtio_wait_used_elem(qts, dev, vq[i], free_head, NULL,
+                               QVIRTIO_BLK_TIMEOUT_US);
+        status = readb(req_addr + 528);
+        g_assert_cmpint(status, ==, 0);
+
+        guest_free(t_alloc, req_addr);
+    }
+
+    /*
+     * Read each sector back through a virtqueue of the other IOThread than
+     * the one that wrote it.
+     */
+    for (i = 0; i < VQ_MAPPING_NUM_QUEUES; i++) {
+        QVirtQueue *rvq = vq[(i + 1) % VQ_MAPPING_NUM_QUEUES];
+        char *expected = g_strdup_printf("TEST%d", i);
+
+        req.type = VIRTIO_BLK_T_IN;
+        req.ioprio = 1;
+        req.sector = i;
+        req.data = g_malloc0(512);
+
+        req_addr = virtio_blk_request(t_alloc, dev, &req, 512);
+
+        g_free(req.data);
+
+        free_head = qvirtqueue_add(qts, rvq, req_addr, 16, false, true);
+        qvirtqueue_add(qts, rvq, req_addr + 16, 512, true, true);
+        qvirtqueue_add(qts, rvq, req_addr + 528, 1, true, false);
+        qvirtqueue_kick(qts, dev, rvq, free_head);
+
+        qvirtio_wait_used_elem(qts, dev, rvq, free_head, NULL,
+                               QVIRTIO_BLK_TIMEOUT_US);
+        status = readb(req_addr + 528);
+        g_assert_cmpint(status, ==, 0);
+
+        data_buf = g_malloc0(512);
+        memread(req_addr + 16, data_buf, 512);
+        g_assert_cmpstr(data_buf, ==, expected);
+        g_free(data_buf);
+        g_free(expected);
+
+        guest_free(t_alloc, req_addr);
+    }
+
+    for (i = 0; i < VQ_MAPPING_NUM_QUEUES; i++) {
+        qvirtqueue_cleanup(dev->bus, vq[i], t_alloc);
+    }
+    qvirtio_pci_device_disable(pdev);
+    qos_object_destroy((QOSGraphObject *)pdev);
+
+    qpci_unplug_acpi_device_test(qts, "drv2", PCI_SLOT_HP);
+}
+
 /*
  * Check that setting the vring addr on a non-existent virtqueue does
  * not crash.
@@ -785,11 +909,28 @@ static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
     return arg;
 }
 
+static void *virtio_blk_vq_mapping_setup(GString *cmd_line, void *arg)
+{
+    char *tmp_path = drive_create();
+
+    g_string_append_printf(cmd_line,
+                           " -object iothread,id=iothread0"
+                           " -object iothread,id=iothread1"
+                           " -drive if=none,id=drive2,file=%s,"
+                           "format=raw,auto-read-only=off ",
+                           tmp_path);
+
+    return virtio_blk_test_setup(cmd_line, arg);
+}
+
 static void register_virtio_blk_test(void)
 {
     QOSGraphTestOptions opts = {
         .before = virtio_blk_test_setup,
     };
+    QOSGraphTestOptions vq_mapping_opts = {
+        .before = virtio_blk_vq_mapping_setup,
+    };
 
     qos_add_test("indirect", "virtio-blk", indirect, &opts);
     qos_add_test("config", "virtio-blk", config, &opts);
@@ -802,6 +943,8 @@ static void register_virtio_blk_test(void)
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
+    qos_add_test("iothread-vq-mapping", "virtio-blk-pci", iothread_vq_mapping,
+                 &vq_mapping_opts);
 }
 
 libqos_init(register_virtio_blk_test);
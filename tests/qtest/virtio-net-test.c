@@ -12,6 +12,8 @@
 #include "qemu/iov.h"
 #include "qemu/module.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
 #include "hw/virtio/virtio-net.h"
 #include "libqos/qgraph.h"
 #include "libqos/virtio-net.h"
@@ -24,6 +26,8 @@
 #define PCI_SLOT                0x04
 
 #define QVIRTIO_NET_TIMEOUT_US (30 * 1000 * 1000)
+#define TX_BURST_PACKETS 8
+#define RX_BURST_PACKETS 8
 #define VNET_HDR_SIZE sizeof(struct virtio_net_hdr_mrg_rxbuf)
 
 #ifndef _WIN32
@@ -143,6 +147,149 @@ static void rx_stop_cont_test(QVirtioDevice *dev,
     guest_free(alloc, req_addr);
 }
 
+static void tx_burst_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *vq = net_if->queues[1];
+    QTestState *qts = global_qtest;
+    uint64_t req_addr[TX_BURST_PACKETS];
+    uint32_t free_head[TX_BURST_PACKETS];
+    uint32_t desc_idx;
+    char buffer[64];
+    char *expected;
+    QDict *rsp, *result;
+    QList *stats, *hist;
+    QListEntry *entry;
+    int *sv = data;
+    int i, ret;
+
+    /* Queue the whole burst while stopped so that one flush sees all of it */
+    rsp = qmp("{ 'execute' : 'stop'}");
+    qobject_unref(rsp);
+
+    for (i = 0; i < TX_BURST_PACKETS; i++) {
+        expected = g_strdup_printf("BURST%d", i);
+        req_addr[i] = guest_alloc(t_alloc, 64);
+        memwrite(req_addr[i] + VNET_HDR_SIZE, expected, strlen(expected) + 1);
+        g_free(expected);
+
+        free_head[i] = qvirtqueue_add(qts, vq, req_addr[i], 64, false, false);
+        qvirtqueue_kick(qts, dev, vq, free_head[i]);
+    }
+
+    rsp = qmp("{ 'execute' : 'cont'}");
+    qobject_unref(rsp);
+
+    /* All packets are completed with a single used ring update */
+    qvirtio_wait_used_elem(qts, dev, vq, free_head[0], NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    for (i = 1; i < TX_BURST_PACKETS; i++) {
+        g_assert(qvirtqueue_get_buf(qts, vq, &desc_idx, NULL));
+        g_assert_cmpint(desc_idx, ==, free_head[i]);
+    }
+
+    for (i = 0; i < TX_BURST_PACKETS; i++) {
+        guest_free(t_alloc, req_addr[i]);
+
+        ret = recv(sv[0], buffer, sizeof(buffer), 0);
+        g_assert_cmpint(ret, ==, 64 - VNET_HDR_SIZE);
+        expected = g_strdup_printf("BURST%d", i);
+        g_assert_cmpstr(buffer, ==, expected);
+        g_free(expected);
+    }
+
+    /* The burst is accounted in the bucket for 8 to 15 packets */
+    rsp = qmp("{ 'execute': 'query-stats',"
+              "  'arguments': { 'target': 'virtio-net' } }");
+    stats = qdict_get_qlist(rsp, "return");
+    g_assert_cmpint(qlist_size(stats), ==, 1);
+    result = qobject_to(QDict, qlist_peek(stats));
+    stats = qdict_get_qlist(result, "stats");
+    result = qobject_to(QDict, qlist_peek(stats));
+    g_assert_cmpstr(qdict_get_str(result, "name"), ==, "tx-burst");
+    hist = qdict_get_qlist(result, "value");
+
+    i = 0;
+    QLIST_FOREACH_ENTRY(hist, entry) {
+        QNum *num = qobject_to(QNum, qlist_entry_obj(entry));
+        g_assert_cmpuint(qnum_get_uint(num), ==, i == 4 ? 1 : 0);
+        i++;
+    }
+    g_assert_cmpint(i, ==, 8);
+    qobject_unref(rsp);
+}
+
+static void rx_burst_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *vq = net_if->queues[0];
+    QTestState *qts = global_qtest;
+    uint64_t req_addr[RX_BURST_PACKETS];
+    uint32_t free_head[RX_BURST_PACKETS];
+    uint32_t desc_idx;
+    char buffer[64];
+    char *expected;
+    GString *packets = g_string_new(NULL);
+    QDict *rsp;
+    gint64 deadline;
+    int *sv = data;
+    int i, ret;
+
+    for (i = 0; i < RX_BURST_PACKETS; i++) {
+        req_addr[i] = guest_alloc(t_alloc, 64);
+        free_head[i] = qvirtqueue_add(qts, vq, req_addr[i], 64, true, false);
+        qvirtqueue_kick(qts, dev, vq, free_head[i]);
+    }
+
+    /*
+     * Queue the packets in QEMU while stopped, so that they are delivered
+     * to the guest as one burst on 'cont'.
+     */
+    rsp = qmp("{ 'execute' : 'stop'}");
+    qobject_unref(rsp);
+
+    for (i = 0; i < RX_BURST_PACKETS; i++) {
+        uint32_t len;
+
+        expected = g_strdup_printf("BURST%d", i);
+        len = htonl(strlen(expected) + 1);
+        g_string_append_len(packets, (char *)&len, sizeof(len));
+        g_string_append_len(packets, expected, strlen(expected) + 1);
+        g_free(expected);
+    }
+    ret = send(sv[0], packets->str, packets->len, 0);
+    g_assert_cmpint(ret, ==, packets->len);
+    g_string_free(packets, true);
+
+    rsp = qmp("{ 'execute' : 'query-status'}");
+    qobject_unref(rsp);
+    rsp = qmp("{ 'execute' : 'cont'}");
+    qobject_unref(rsp);
+
+    /* The guest is notified, and every buffer is completed in order */
+    qvirtio_wait_used_elem(qts, dev, vq, free_head[0], NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    deadline = g_get_monotonic_time() + QVIRTIO_NET_TIMEOUT_US;
+    for (i = 1; i < RX_BURST_PACKETS; i++) {
+        while (!qvirtqueue_get_buf(qts, vq, &desc_idx, NULL)) {
+            g_assert_cmpint(g_get_monotonic_time(), <, deadline);
+            g_usleep(1000);
+        }
+        g_assert_cmpint(desc_idx, ==, free_head[i]);
+    }
+
+    for (i = 0; i < RX_BURST_PACKETS; i++) {
+        expected = g_strdup_printf("BURST%d", i);
+        memread(req_addr[i] + VNET_HDR_SIZE, buffer, strlen(expected) + 1);
+        g_assert_cmpstr(buffer, ==, expected);
+        g_free(expected);
+
+        guest_free(t_alloc, req_addr[i]);
+    }
+}
+
 static void send_recv_test(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioNet *net_if = obj;
@@ -270,6 +417,22 @@ static void virtio_net_test_cleanup(void *sockets)
     g_free(sv);
 }
 
+static void *virtio_net_test_setup_dgram(GString *cmd_line, void *arg)
+{
+    int ret;
+    int *sv = g_new(int, 2);
+
+    ret = socketpair(PF_UNIX, SOCK_DGRAM, 0, sv);
+    g_assert_cmpint(ret, !=, -1);
+
+    g_string_append_printf(cmd_line,
+                           " -netdev dgram,id=hs0,local.type=fd,local.str=%d ",
+                           sv[1]);
+
+    g_test_queue_destroy(virtio_net_test_cleanup, sv);
+    return sv;
+}
+
 static void *virtio_net_test_setup(GString *cmd_line, void *arg)
 {
     int ret;
@@ -326,7 +489,10 @@ static void register_virtio_net_test(void)
     qos_add_test("hotplug", "virtio-net-pci", hotplug, &opts);
     qos_add_test("basic", "virtio-net", send_recv_test, &opts);
     qos_add_test("rx_stop_cont", "virtio-net", stop_cont_test, &opts);
+    qos_add_test("rx_burst", "virtio-net", rx_burst_test, &opts);
     qos_add_test("announce-self", "virtio-net", announce_self, &opts);
+    opts.before = virtio_net_test_setup_dgram;
+    qos_add_test("tx_burst", "virtio-net", tx_burst_test, &opts);
 #endif
 
     /* These tests do not need a loopback backend.  */
@@ -23,6 +23,7 @@
 #include "libqos/qgraph.h"
 
 #define PCI_SLOT                0x02
+#define PCI_SLOT_HP             0x06
 #define PCI_FN                  0x00
 #define QVIRTIO_SCSI_TIMEOUT_US (1 * 1000 * 1000)
 
@@ -59,14 +60,15 @@ static uint64_t qvirtio_scsi_alloc(QVirtioSCSIQueues *vs, size_t alloc_size,
     return addr;
 }
 
-static uint8_t virtio_scsi_do_command(QVirtioSCSIQueues *vs,
-                                      const uint8_t *cdb,
-                                      const uint8_t *data_in,
-                                      size_t data_in_len,
-                                      uint8_t *data_out, size_t data_out_len,
-                                      struct virtio_scsi_cmd_resp *resp_out)
+static uint8_t virtio_scsi_do_command_vq(QVirtioSCSIQueues *vs,
+                                         QVirtQueue *vq, uint8_t target,
+                                         const uint8_t *cdb,
+                                         const uint8_t *data_in,
+                                         size_t data_in_len,
+                                         uint8_t *data_out,
+                                         size_t data_out_len,
+                                         struct virtio_scsi_cmd_resp *resp_out)
 {
-    QVirtQueue *vq;
     struct virtio_scsi_cmd_req req = { { 0 } };
     struct virtio_scsi_cmd_resp resp = { .response = 0xff, .status = 0xff };
     uint64_t req_addr, resp_addr, data_in_addr = 0, data_out_addr = 0;
@@ -74,10 +76,8 @@ static uint8_t virtio_scsi_do_command(QVirtioSCSIQueues *vs,
     uint32_t free_head;
     QTestState *qts = global_qtest;
 
-    vq = vs->vq[2];
-
     req.lun[0] = 1; /* Select LUN */
-    req.lun[1] = 1; /* Select target 1 */
+    req.lun[1] = target;
     memcpy(req.cdb, cdb, VIRTIO_SCSI_CDB_SIZE);
 
     /* XXX: Fix endian if any multi-byte field in req/resp is used */
@@ -118,6 +118,19 @@ static uint8_t virtio_scsi_do_command(QVirtioSCSIQueues *vs,
     return response;
 }
 
+static uint8_t virtio_scsi_do_command(QVirtioSCSIQueues *vs,
+                                      const uint8_t *cdb,
+                                      const uint8_t *data_in,
+                                      size_t data_in_len,
+                                      uint8_t *data_out, size_t data_out_len,
+                                      struct virtio_scsi_cmd_resp *resp_out)
+{
+    /* Use the first request queue and target 1 */
+    return virtio_scsi_do_command_vq(vs, vs->vq[2], 1, cdb, data_in,
+                                     data_in_len, data_out, data_out_len,
+                                     resp_out);
+}
+
 static QVirtioSCSIQueues *qvirtio_scsi_init(QVirtioDevice *dev)
 {
     QVirtioSCSIQueues *vs;
@@ -311,6 +324,102 @@ fail:
     unlink(tmp_path);
 }
 
+#define VQ_MAPPING_NUM_QUEUES 4
+#define VQ_MAPPING_NUM_TARGETS 2
+
+/*
+ * Hotplug a controller whose virtqueues are serviced by two IOThreads, with
+ * LUNs spread over both, and access every LUN through every request queue.
+ */
+static void test_iothread_vq_mapping(void *obj, void *data,
+                                     QGuestAllocator *t_alloc)
+{
+    QVirtioSCSIPCI *scsi_pci = obj;
+    QPCIBus *bus = scsi_pci->pci_vdev.pdev->bus;
+    QTestState *qts = bus->qts;
+    QVirtioPCIDevice *pdev;
+    QVirtioSCSIQueues *vs;
+    const uint8_t test_unit_ready_cdb[VIRTIO_SCSI_CDB_SIZE] = {};
+    struct virtio_scsi_cmd_resp resp;
+    uint8_t buf[512] = { 0 };
+    int i, target;
+
+    if (bus->not_hotpluggable) {
+        g_test_skip("pci bus does not support hotplug");
+        return;
+    }
+
+    qtest_qmp_device_add(qts, "virtio-scsi-pci", "scsi-hp",
+                         "{'addr': %s, 'num_queues': %d,"
+                         " 'iothread-vq-mapping': ['thread0', 'thread1']}",
+                         stringify(PCI_SLOT_HP) ".0", VQ_MAPPING_NUM_QUEUES);
+    for (target = 1; target <= VQ_MAPPING_NUM_TARGETS; target++) {
+        g_autofree char *id = g_strdup_printf("scsi-hp-hd%d", target);
+
+        qtest_qmp_device_add(qts, "scsi-hd", id,
+                             "{'bus': 'scsi-hp.0', 'drive': 'null%d',"
+                             " 'scsi-id': %d, 'lun': 0}",
+                             target, target);
+    }
+
+    pdev = virtio_pci_new(bus, &(QPCIAddress) {
+                              .devfn = QPCI_DEVFN(PCI_SLOT_HP, 0)
+                          });
+    g_assert_nonnull(pdev);
+    g_assert_cmpint(pdev->vdev.device_type, ==, VIRTIO_ID_SCSI);
+    qvirtio_pci_device_enable(pdev);
+    qvirtio_start_device(&pdev->vdev);
+
+    alloc = t_alloc;
+    vs = qvirtio_scsi_init(&pdev->vdev);
+    g_assert_cmpint(vs->num_queues, ==, VQ_MAPPING_NUM_QUEUES);
+
+    /* Clear the POWER ON OCCURRED unit attention of the other targets */
+    for (target = 2; target <= VQ_MAPPING_NUM_TARGETS; target++) {
+        virtio_scsi_do_command_vq(vs, vs->vq[2], target, test_unit_ready_cdb,
+                                  NULL, 0, NULL, 0, NULL);
+    }
+
+    for (i = 0; i < VQ_MAPPING_NUM_QUEUES; i++) {
+        QVirtQueue *vq = vs->vq[2 + i];
+
+        for (target = 1; target <= VQ_MAPPING_NUM_TARGETS; target++) {
+            const uint8_t write_cdb[VIRTIO_SCSI_CDB_SIZE] = {
+                /* WRITE(10) to LBA i, transfer length 1 */
+                0x2a, 0x00, 0x00, 0x00, 0x00, i, 0x00, 0x00, 0x01, 0x00
+            };
+            const uint8_t read_cdb[VIRTIO_SCSI_CDB_SIZE] = {
+                /* READ(10) from LBA i, transfer length 1 */
+                0x28, 0x00, 0x00, 0x00, 0x00, i, 0x00, 0x00, 0x01, 0x00
+            };
+
+            g_assert_cmphex(virtio_scsi_do_command_vq(vs, vq, target,
+                                                      test_unit_ready_cdb,
+                                                      NULL, 0, NULL, 0,
+                                                      &resp), ==, 0);
+            g_assert_cmphex(resp.status, ==, GOOD);
+
+            g_assert_cmphex(virtio_scsi_do_command_vq(vs, vq, target,
+                                                      write_cdb, NULL, 0,
+                                                      buf, sizeof(buf),
+                                                      &resp), ==, 0);
+            g_assert_cmphex(resp.status, ==, GOOD);
+
+            g_assert_cmphex(virtio_scsi_do_command_vq(vs, vq, target,
+                                                      read_cdb, buf,
+                                                      sizeof(buf), NULL, 0,
+                                                      &resp), ==, 0);
+            g_assert_cmphex(resp.status, ==, GOOD);
+        }
+    }
+
+    qvirtio_scsi_pci_free(vs);
+    qvirtio_pci_device_disable(pdev);
+    qos_object_destroy((QOSGraphObject *)pdev);
+
+    qpci_unplug_acpi_device_test(qts, "scsi-hp", PCI_SLOT_HP);
+}
+
 static void *virtio_scsi_hotplug_setup(GString *cmd_line, void *arg)
 {
     g_string_append(cmd_line,
@@ -359,6 +468,16 @@ static void *virtio_scsi_setup_iothread(GString *cmd_line, void *arg)
     return arg;
 }
 
+static void *virtio_scsi_setup_vq_mapping(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line,
+                    " -object iothread,id=thread0"
+                    " -object iothread,id=thread1"
+                    " -blockdev driver=null-co,read-zeroes=on,node-name=null1"
+                    " -blockdev driver=null-co,read-zeroes=on,node-name=null2");
+    return arg;
+}
+
 static void register_virtio_scsi_test(void)
 {
     QOSGraphTestOptions opts = { };
@@ -383,6 +502,11 @@ static void register_virtio_scsi_test(void)
     };
     qos_add_test("iothread-attach-node", "virtio-scsi-pci",
                  test_iothread_attach_node, &opts);
+
+    opts.before = virtio_scsi_setup_vq_mapping;
+    opts.edge = (QOSGraphEdgeOptions) { };
+    qos_add_test("iothread-vq-mapping", "virtio-scsi-pci",
+                 test_iothread_vq_mapping, &opts);
 }
 
 libqos_init(register_virtio_scsi_test);
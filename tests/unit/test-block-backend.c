@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "block/block.h"
+#include "block/block_int.h"
 #include "sysemu/block-backend.h"
 #include "qapi/error.h"
 #include "qemu/main-loop.h"
@@ -70,6 +71,133 @@ static void test_drain_all_aio_error(void)
     blk_unref(blk);
 }
 
+/* Reads return the number of each 512 byte sector, plus one, in every byte */
+typedef struct BDRVPatternState {
+    int reads;
+} BDRVPatternState;
+
+static int64_t coroutine_fn bdrv_pattern_co_getlength(BlockDriverState *bs)
+{
+    return 64 * 1024;
+}
+
+static int coroutine_fn bdrv_pattern_co_preadv(BlockDriverState *bs,
+                                               int64_t offset, int64_t bytes,
+                                               QEMUIOVector *qiov,
+                                               BdrvRequestFlags flags)
+{
+    BDRVPatternState *s = bs->opaque;
+    int64_t pos;
+
+    g_assert(QEMU_IS_ALIGNED(offset | bytes, 512));
+    for (pos = 0; pos < bytes; pos += 512) {
+        qemu_iovec_memset(qiov, pos, (offset + pos) / 512 + 1, 512);
+    }
+    s->reads++;
+
+    return 0;
+}
+
+static BlockDriver bdrv_pattern = {
+    .format_name            = "pattern",
+    .instance_size          = sizeof(BDRVPatternState),
+
+    .bdrv_co_getlength      = bdrv_pattern_co_getlength,
+    .bdrv_co_preadv         = bdrv_pattern_co_preadv,
+};
+
+static void test_request_merging_cb(void *opaque, int ret)
+{
+    int *completed = opaque;
+
+    g_assert(ret == -ENOMEDIUM);
+    (*completed)++;
+}
+
+static void test_request_merging_read_cb(void *opaque, int ret)
+{
+    int *completed = opaque;
+
+    g_assert(ret == 0);
+    (*completed)++;
+}
+
+static void test_request_merging(void)
+{
+    BlockBackend *blk = blk_new(qemu_get_aio_context(),
+                                BLK_PERM_ALL, BLK_PERM_ALL);
+    BlockDriverState *bs;
+    BDRVPatternState *s;
+    static const int64_t offsets[] = { 512, 0, 4096 };
+    QEMUIOVector qiov[ARRAY_SIZE(offsets)];
+    uint8_t buf[ARRAY_SIZE(offsets)][512];
+    int completed = 0;
+    int i, j;
+
+    bs = bdrv_new_open_driver(&bdrv_pattern, "pattern-node", BDRV_O_RDWR,
+                              &error_abort);
+    s = bs->opaque;
+    blk_insert_bs(blk, bs, &error_abort);
+    blk_set_request_merging(blk, true);
+
+    blk_io_plug(blk);
+    for (i = 0; i < ARRAY_SIZE(offsets); i++) {
+        memset(buf[i], 0, sizeof(buf[i]));
+        qemu_iovec_init_buf(&qiov[i], buf[i], sizeof(buf[i]));
+        blk_aio_preadv(blk, offsets[i], &qiov[i], 0,
+                       test_request_merging_read_cb, &completed);
+    }
+    g_assert(completed == 0);
+    g_assert(s->reads == 0);
+    blk_io_unplug(blk);
+
+    blk_drain(blk);
+    g_assert(completed == ARRAY_SIZE(offsets));
+
+    /* The requests at 0 and 512 were submitted as one */
+    g_assert(blk_get_stats(blk)->merged[BLOCK_ACCT_READ] == 1);
+    g_assert(s->reads == 2);
+
+    /* Each request got the data at its own offset */
+    for (i = 0; i < ARRAY_SIZE(offsets); i++) {
+        for (j = 0; j < sizeof(buf[i]); j++) {
+            g_assert_cmpint(buf[i][j], ==, offsets[i] / 512 + 1);
+        }
+    }
+
+    blk_unref(blk);
+    bdrv_unref(bs);
+}
+
+static void test_request_merging_drain(void)
+{
+    BlockBackend *blk = blk_new(qemu_get_aio_context(),
+                                BLK_PERM_ALL, BLK_PERM_ALL);
+    QEMUIOVector qiov[2];
+    uint8_t buf[512];
+    int completed = 0;
+    int i;
+
+    blk_set_request_merging(blk, true);
+
+    blk_io_plug(blk);
+    for (i = 0; i < ARRAY_SIZE(qiov); i++) {
+        qemu_iovec_init_buf(&qiov[i], buf, sizeof(buf));
+        blk_aio_preadv(blk, i * sizeof(buf), &qiov[i], 0,
+                       test_request_merging_cb, &completed);
+    }
+    g_assert(completed == 0);
+
+    /* Draining inside the plug window must not wait for the unplug */
+    blk_drain(blk);
+    g_assert(completed == ARRAY_SIZE(qiov));
+
+    blk_drain_all();
+    blk_io_unplug(blk);
+
+    blk_unref(blk);
+}
+
 int main(int argc, char **argv)
 {
     bdrv_init();
@@ -80,6 +208,9 @@ int main(int argc, char **argv)
     g_test_add_func("/block-backend/drain_aio_error", test_drain_aio_error);
     g_test_add_func("/block-backend/drain_all_aio_error",
                     test_drain_all_aio_error);
+    g_test_add_func("/block-backend/request_merging", test_request_merging);
+    g_test_add_func("/block-backend/request_merging_drain",
+                    test_request_merging_drain);
 
     return g_test_run();
 }
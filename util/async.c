@@ -350,6 +350,12 @@ aio_ctx_finalize(GSource     *source)
         luring_cleanup(ctx->linux_io_uring);
         ctx->linux_io_uring = NULL;
     }
+
+    if (ctx->linux_io_uring_iopoll) {
+        luring_detach_aio_context(ctx->linux_io_uring_iopoll, ctx);
+        luring_cleanup(ctx->linux_io_uring_iopoll);
+        ctx->linux_io_uring_iopoll = NULL;
+    }
 #endif
 
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
@@ -434,7 +440,7 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(false, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -448,6 +454,27 @@ LuringState *aio_get_linux_io_uring(AioContext *ctx)
     assert(ctx->linux_io_uring);
     return ctx->linux_io_uring;
 }
+
+LuringState *aio_setup_linux_io_uring_iopoll(AioContext *ctx, Error **errp)
+{
+    if (ctx->linux_io_uring_iopoll) {
+        return ctx->linux_io_uring_iopoll;
+    }
+
+    ctx->linux_io_uring_iopoll = luring_init(true, errp);
+    if (!ctx->linux_io_uring_iopoll) {
+        return NULL;
+    }
+
+    luring_attach_aio_context(ctx->linux_io_uring_iopoll, ctx);
+    return ctx->linux_io_uring_iopoll;
+}
+
+LuringState *aio_get_linux_io_uring_iopoll(AioContext *ctx)
+{
+    assert(ctx->linux_io_uring_iopoll);
+    return ctx->linux_io_uring_iopoll;
+}
 #endif
 
 void aio_notify(AioContext *ctx)
@@ -571,6 +598,7 @@ AioContext *aio_context_new(Error **errp)
 
 #ifdef CONFIG_LINUX_IO_URING
     ctx->linux_io_uring = NULL;
+    ctx->linux_io_uring_iopoll = NULL;
 #endif
 
     ctx->thread_pool = NULL;